@@ -0,0 +1,12 @@
+#include "NeuralEngine.h"
+#include "NeuralEnvEngine.h"
+#include "NeuralSerialEngine.h"
+
+NeuralEngine* NeuralEngine::Create(TableOptions &opts, int bucket, atomic<unsigned int> *clock) {
+    switch (opts.engine) {
+        case ENGINE_SERIALIZED:
+            return new NeuralSerialEngine();
+        default:
+            return new NeuralEnvEngine(opts, bucket, clock);
+    }
+}
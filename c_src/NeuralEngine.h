@@ -0,0 +1,178 @@
+#ifndef NEURALENGINE_H
+#define NEURALENGINE_H
+
+#include "erl_nif.h"
+#include <string>
+#include <atomic>
+#include <functional>
+
+#define TIER_DEFAULT_IDLE 300
+#define COMPRESS_DEFAULT_IDLE 60
+#define EXPORT_DEFAULT_SLOTS 65536
+#define TENURE_DEFAULT_AGE 2
+#define LARGE_DEFAULT_SIZE 65536
+
+#define ENGINE_ENV          0
+#define ENGINE_SERIALIZED   1
+
+#define GC_BYTES            0
+#define GC_RATIO            1
+#define GC_ADAPTIVE         2
+#define GC_DEFAULT_BYTES    1048576
+#define GC_DEFAULT_PARALLELISM 4
+
+using namespace std;
+
+class NeuralStore;
+class NeuralExport;
+
+/* When a table collects its garbage: once it holds bytes of it, once
+ * it holds ratio times the size of the live entries, or once it holds
+ * what the table works out from its write rate and collection cost.
+ * Collections start at most once per min_interval milliseconds, and
+ * collect up to parallelism buckets at a time.
+ *
+ * Writes slow down once the table holds soft_limit bytes of garbage,
+ * which also starts a collection whatever the policy, and are refused
+ * from hard_limit bytes on. 0 is no limit.
+ */
+struct GcPolicy {
+    GcPolicy() : mode(GC_BYTES), bytes(GC_DEFAULT_BYTES), ratio(1.0), min_interval(0), parallelism(GC_DEFAULT_PARALLELISM),
+                 soft_limit(0), hard_limit(0) { }
+
+    int                 mode;
+    unsigned long int   bytes;
+    double              ratio;
+    unsigned int        min_interval;
+    unsigned int        parallelism;
+    unsigned long int   soft_limit;
+    unsigned long int   hard_limit;
+};
+
+struct TableOptions {
+    TableOptions() : key_pos(1), engine(ENGINE_ENV), tier_idle(TIER_DEFAULT_IDLE), compress_size(0), compress_idle(COMPRESS_DEFAULT_IDLE),
+                     store(NULL), export_slots(EXPORT_DEFAULT_SLOTS), exporter(NULL),
+                     trace_sample(0), trace_slow(0), trace_size(0), hot_sample(0), tenure_age(TENURE_DEFAULT_AGE),
+                     large_size(LARGE_DEFAULT_SIZE) { }
+
+    string          name;
+    unsigned int    key_pos;
+    int             engine;
+    string          tier_path;
+    unsigned int    tier_idle;
+    unsigned int    compress_size;
+    unsigned int    compress_idle;
+    string          persist_path;
+    NeuralStore     *store;
+    string          export_name;
+    unsigned long int export_slots;
+    NeuralExport    *exporter;
+    unsigned int    trace_sample;
+    unsigned long int trace_slow;
+    unsigned int    trace_size;
+    unsigned int    hot_sample;
+    unsigned int    tenure_age;
+    unsigned long int large_size;
+    GcPolicy        gc;
+};
+
+typedef function<void(unsigned long int key, ERL_NIF_TERM term)> EntryVisitor;
+
+/* A tuple made ready for put() before the bucket lock is taken, so
+ * that the copying is done by then. What gets prepared is up to the
+ * engine: the tuple copied into an env of its own, its encoding, or
+ * nothing. An env that put() doesn't take over is freed with it.
+ */
+struct StagedTuple {
+    StagedTuple() : term(0), env(NULL), size(0) { }
+    ~StagedTuple() {
+        if (env != NULL) {
+            enif_free_env(env);
+        }
+    }
+    StagedTuple(const StagedTuple &other) = delete;
+    StagedTuple& operator=(const StagedTuple &other) = delete;
+
+    // Takes over whatever other staged, leaving other empty.
+    void take(StagedTuple &other) {
+        term = other.term;
+        env = other.env;
+        size = other.size;
+        record.swap(other.record);
+        other.env = NULL;
+    }
+
+    ERL_NIF_TERM        term;
+    ErlNifEnv           *env;
+    unsigned long int   size;
+    string              record;
+};
+
+/* What clear() took out of an engine. Deleting it frees that, and
+ * needs no lock, so it can be left to another thread.
+ */
+class EngineLeftovers {
+    public:
+        virtual ~EngineLeftovers() { }
+};
+
+/* Holds the entries of one table bucket. The table serializes access
+ * with the bucket lock: the methods in the first group are safe under
+ * the read lock, everything else needs the write lock.
+ *
+ * Terms handed out by find() and erase(), and those built by callers
+ * in env(), stay valid until the next call that needs the write lock.
+ * Callers pass every such term they drop to discard(), along with the
+ * key it was stored under, so the engine can account for it as
+ * garbage.
+ */
+class NeuralEngine {
+    public:
+        static NeuralEngine* Create(TableOptions &opts, int bucket, atomic<unsigned int> *clock);
+        virtual ~NeuralEngine() { }
+
+        virtual bool contains(unsigned long int key) = 0;
+        // False if find() would have to modify the engine to answer.
+        virtual bool resident(unsigned long int key) = 0;
+        // Copies the tuple stored under key into dest.
+        virtual bool read(unsigned long int key, ErlNifEnv *dest, ERL_NIF_TERM &ret) = 0;
+        // Calls visit with a copy in dest of every stored tuple.
+        virtual void iterate(ErlNifEnv *dest, EntryVisitor visit) = 0;
+        virtual size_t count() = 0;
+        virtual unsigned long int garbage() = 0;
+        // Roughly how many bytes the stored tuples take up.
+        virtual unsigned long int live() = 0;
+
+        // Prepares tuple, a term of env, for put(). Only reads settings
+        // fixed at creation, so it needs no lock. Returns false if the
+        // engine can't store tuple.
+        virtual bool stage(ErlNifEnv *env, ERL_NIF_TERM tuple, StagedTuple &ret) = 0;
+
+        virtual ErlNifEnv* env() = 0;
+        virtual bool find(unsigned long int key, ERL_NIF_TERM &ret) = 0;
+        // Stores a tuple staged without error under key. Returns the
+        // stored tuple, which is only fit for reading.
+        virtual ERL_NIF_TERM put(unsigned long int key, StagedTuple &staged) = 0;
+        bool put(unsigned long int key, ERL_NIF_TERM tuple, ERL_NIF_TERM &ret) {
+            StagedTuple staged;
+            if (!stage(env(), tuple, staged)) {
+                return false;
+            }
+            ret = put(key, staged);
+            return true;
+        }
+        virtual bool erase(unsigned long int key, ERL_NIF_TERM &ret) = 0;
+        virtual void discard(unsigned long int key, ERL_NIF_TERM term) = 0;
+        // Accounts for up to budget discarded terms. Returns the garbage total.
+        virtual unsigned long int tally(int budget) = 0;
+        // Frees the garbage.
+        virtual void compact() = 0;
+        // Moves entries idle since before now out of the way, if the
+        // engine knows how to.
+        virtual void sweep(unsigned int now) = 0;
+        // Empties the engine in constant time, handing everything it
+        // held to the returned leftovers for the caller to delete.
+        virtual EngineLeftovers* clear() = 0;
+};
+
+#endif
@@ -0,0 +1,582 @@
+#include "NeuralEnvEngine.h"
+
+NeuralEnvEngine::NeuralEnvEngine(TableOptions &opts, int bucket, atomic<unsigned int> *clock)
+        : pool(new NeuralNodePool()), entries(0, hash<unsigned long int>(), equal_to<unsigned long int>(), entry_allocator(pool.get())), clock(clock) {
+    char file[32];
+
+    bucket_env = enif_alloc_env();
+    old_env = enif_alloc_env();
+    garbage_can = 0;
+    old_garbage = 0;
+    young_size = 0;
+    young_count = 0;
+    old_size = 0;
+    old_count = 0;
+    tenure_age = opts.tenure_age;
+    large_size = opts.large_size;
+    large_bytes = 0;
+    large_count = 0;
+    reclaimable = enif_make_list(bucket_env, 0);
+
+    tier_idle = opts.tier_idle;
+    compress_size = opts.compress_size;
+    compress_idle = opts.compress_idle;
+    tiered = !opts.tier_path.empty();
+
+    // One segment per bucket, so the bucket lock covers its file.
+    if (tiered) {
+        snprintf(file, sizeof(file), ".%d.seg", bucket);
+        tiered = segment.open(opts.tier_path + "/" + opts.name + file);
+    }
+}
+
+NeuralEnvEngine::~NeuralEnvEngine() {
+    for (hash_table::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.large()) {
+            enif_free_env(it->second.own_env);
+        }
+    }
+    free_dead();
+    enif_free_env(bucket_env);
+    enif_free_env(old_env);
+}
+
+bool NeuralEnvEngine::contains(unsigned long int key) {
+    return entries.find(key) != entries.end();
+}
+
+bool NeuralEnvEngine::resident(unsigned long int key) {
+    hash_table::iterator it = entries.find(key);
+    return it == entries.end() || (!it->second.spilled() && !it->second.compressed());
+}
+
+bool NeuralEnvEngine::read(unsigned long int key, ErlNifEnv *dest, ERL_NIF_TERM &ret) {
+    hash_table::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    it->second.touched.store(now(), memory_order_relaxed);
+    ret = read_entry(dest, it->second);
+    return true;
+}
+
+void NeuralEnvEngine::iterate(ErlNifEnv *dest, EntryVisitor visit) {
+    for (hash_table::iterator it = entries.begin(); it != entries.end(); ++it) {
+        visit(it->first, read_entry(dest, it->second));
+    }
+}
+
+bool NeuralEnvEngine::find(unsigned long int key, ERL_NIF_TERM &ret) {
+    TableEntry *entry = lookup(key);
+    if (entry == NULL) {
+        return false;
+    }
+    ret = entry->term;
+    return true;
+}
+
+/* ================================================================
+ * stage
+ * Copies a large tuple into the env it will be stored in. Smaller ones
+ * are left to put(), which copies them into the bucket env.
+ */
+bool NeuralEnvEngine::stage(ErlNifEnv *env, ERL_NIF_TERM tuple, StagedTuple &ret) {
+    ret.term = tuple;
+    if (large_size == 0) {
+        return true;
+    }
+
+    ret.size = estimate_size(env, tuple);
+    if (ret.size >= large_size) {
+        ret.env = enif_alloc_env();
+        ret.term = enif_make_copy(ret.env, tuple);
+    }
+
+    return true;
+}
+
+ERL_NIF_TERM NeuralEnvEngine::put(unsigned long int key, StagedTuple &staged) {
+    TableEntry &entry = entries[key];
+
+    free_dead();
+    if (entry.spilled()) {
+        segment.release(entry.spill_size);
+        entry.spill_offset = -1;
+    }
+    if (retire(entry)) {
+        retired.push_back(key);
+    }
+    drop_large(entry, key);
+    if (staged.env != NULL) {
+        adopt(entry, key, staged.env, staged.size);
+        staged.env = NULL;
+        entry.term = staged.term;
+    } else {
+        entry.term = enif_make_copy(bucket_env, staged.term);
+    }
+    entry.flags = 0;
+    entry.age = 0;
+    entry.touched.store(now(), memory_order_relaxed);
+
+    return entry.term;
+}
+
+bool NeuralEnvEngine::erase(unsigned long int key, ERL_NIF_TERM &ret) {
+    TableEntry *entry;
+
+    free_dead();
+    entry = lookup(key);
+    if (entry == NULL) {
+        return false;
+    }
+    ret = entry->term;
+    if (retire(*entry)) {
+        retired.push_back(key);
+    }
+    drop_large(*entry, key);
+    entries.erase(key);
+    return true;
+}
+
+/* ================================================================
+ * discard
+ * Terms dropped from a large entry go with its env, and must not be
+ * looked at once it is freed. A small entry that has just grown large
+ * loses its discards too, which only undercounts the garbage. Terms
+ * of a retired entry live in the old env and are counted already.
+ */
+void NeuralEnvEngine::discard(unsigned long int key, ERL_NIF_TERM term) {
+    hash_table::iterator it;
+
+    for (size_t i = 0; i < retired.size(); ++i) {
+        if (retired[i] == key) {
+            return;
+        }
+    }
+    if (large_count > 0 || !dead.empty()) {
+        for (size_t i = 0; i < dead.size(); ++i) {
+            if (dead[i].first == key) {
+                return;
+            }
+        }
+        it = entries.find(key);
+        if (it != entries.end() && it->second.large()) {
+            return;
+        }
+    }
+    reclaimable = enif_make_list_cell(bucket_env, term, reclaimable);
+}
+
+unsigned long int NeuralEnvEngine::tally(int budget) {
+    ERL_NIF_TERM hd;
+
+    free_dead();
+    while (budget-- > 0 && enif_get_list_cell(bucket_env, reclaimable, &hd, &reclaimable)) {
+        garbage_can += estimate_size(bucket_env, hd);
+    }
+
+    return garbage_can;
+}
+
+/* ================================================================
+ * compact
+ * A minor compaction copies the live young entries into a fresh young
+ * env, or into the old env once they are old enough, and frees the
+ * young garbage. A major one, due once most of the garbage is old or
+ * the old env is half garbage, rebuilds the old env as well.
+ */
+void NeuralEnvEngine::compact() {
+    ErlNifEnv *fresh = enif_alloc_env();
+    ErlNifEnv *fresh_old = old_env;
+    bool major = old_garbage > 0 && (old_garbage * 2 >= garbage_can || old_garbage * 2 >= old_size);
+
+    if (major) {
+        fresh_old = enif_alloc_env();
+        old_size = 0;
+    }
+
+    young_size = 0;
+    young_count = 0;
+    for (hash_table::iterator it = entries.begin(); it != entries.end(); ++it) {
+        TableEntry &entry = it->second;
+
+        if (entry.spilled() || entry.large()) {
+            continue;
+        }
+        if (entry.tenured()) {
+            if (major) {
+                entry.term = enif_make_copy(fresh_old, entry.term);
+                old_size += estimate_size(fresh_old, entry.term);
+            }
+        } else if (tenure_age > 0 && ++entry.age >= tenure_age) {
+            entry.term = enif_make_copy(fresh_old, entry.term);
+            entry.flags |= ENTRY_TENURED;
+            old_size += estimate_size(fresh_old, entry.term);
+            ++old_count;
+        } else {
+            entry.term = enif_make_copy(fresh, entry.term);
+            young_size += estimate_size(fresh, entry.term);
+            ++young_count;
+        }
+    }
+
+    enif_free_env(bucket_env);
+    bucket_env = fresh;
+    if (major) {
+        enif_free_env(old_env);
+        old_env = fresh_old;
+        old_garbage = 0;
+    }
+    garbage_can = old_garbage;
+    reclaimable = enif_make_list(fresh, 0);
+    free_dead();
+}
+
+/* ================================================================
+ * retire
+ * Accounts for the term of a tenured entry that is about to be
+ * replaced or dropped. Its space in the old env is garbage until the
+ * next major compaction; the entry itself is young again. The term is
+ * counted as garbage here, so it must not be discarded as well: that
+ * would keep an old env term in the bucket env. Returns whether the
+ * entry was tenured.
+ */
+bool NeuralEnvEngine::retire(TableEntry &entry) {
+    unsigned long int size;
+
+    if (!entry.tenured()) {
+        return false;
+    }
+    size = estimate_size(old_env, entry.term);
+    old_garbage += size;
+    garbage_can += size;
+    old_size -= size < old_size ? size : old_size;
+    --old_count;
+    entry.flags &= ~ENTRY_TENURED;
+    entry.age = 0;
+
+    return true;
+}
+
+/* ================================================================
+ * live
+ * Measuring every entry is left to compact(), which visits them all
+ * anyway; in between, entries are assumed to keep their average size.
+ */
+unsigned long int NeuralEnvEngine::live() {
+    if (young_count + old_count == 0) {
+        return large_bytes;
+    }
+    return (young_size + old_size) / (young_count + old_count) * (entries.size() - large_count) + large_bytes;
+}
+
+/* ================================================================
+ * sweep
+ * Compresses entries that have not been touched for compress_idle
+ * seconds, spills those untouched for tier_idle seconds, and compacts
+ * the segment once it is mostly dead.
+ */
+void NeuralEnvEngine::sweep(unsigned int now) {
+    unsigned int idle, touched;
+
+    if (!tiered && compress_size == 0) {
+        return;
+    }
+
+    for (hash_table::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.spilled()) {
+            continue;
+        }
+
+        // The clock is monotonic, but an entry touched after now was
+        // read must not look idle for a century.
+        touched = it->second.touched.load(memory_order_relaxed);
+        idle = (int)(now - touched) > 0 ? now - touched : 0;
+        if (compress_size > 0 && idle >= compress_idle && !(it->second.flags & (ENTRY_COMPRESSED | ENTRY_INCOMPRESSIBLE))) {
+            compress(it->first, it->second);
+        }
+        if (tiered && idle >= tier_idle) {
+            spill(it->first, it->second);
+        }
+    }
+    free_dead();
+    if (segment.wasteful()) {
+        compact_segment();
+    }
+}
+
+/* ================================================================
+ * clear
+ * Hands the entries, their pool, both envs and the dead envs over to
+ * the leftovers and starts again with new ones. Only the segment is
+ * emptied here, as spills would otherwise append to it.
+ */
+EngineLeftovers* NeuralEnvEngine::clear() {
+    EnvLeftovers *ret = new EnvLeftovers(pool.release());
+
+    ret->entries.swap(entries);
+    ret->bucket_env = bucket_env;
+    ret->old_env = old_env;
+    ret->dead.swap(dead);
+    retired.clear();
+
+    pool.reset(new NeuralNodePool());
+    entries = hash_table(0, hash<unsigned long int>(), equal_to<unsigned long int>(), entry_allocator(pool.get()));
+    bucket_env = enif_alloc_env();
+    old_env = enif_alloc_env();
+    large_bytes = 0;
+    large_count = 0;
+    garbage_can = 0;
+    old_garbage = 0;
+    young_size = 0;
+    young_count = 0;
+    old_size = 0;
+    old_count = 0;
+    reclaimable = enif_make_list(bucket_env, 0);
+    segment.truncate();
+
+    return ret;
+}
+
+EnvLeftovers::~EnvLeftovers() {
+    for (hash_table::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.large()) {
+            enif_free_env(it->second.own_env);
+        }
+    }
+    for (size_t i = 0; i < dead.size(); ++i) {
+        enif_free_env(dead[i].second);
+    }
+    enif_free_env(bucket_env);
+    enif_free_env(old_env);
+}
+
+/* ================================================================
+ * lookup
+ * Returns the entry for key, or NULL if there is none. A spilled or
+ * compressed entry is brought back into the bucket env first.
+ */
+TableEntry* NeuralEnvEngine::lookup(unsigned long int key) {
+    hash_table::iterator it = entries.find(key);
+    if (it == entries.end()) {
+        return NULL;
+    }
+
+    if (it->second.spilled()) {
+        fault(key, it->second);
+    }
+    if (it->second.compressed()) {
+        inflate(key, it->second);
+    }
+    it->second.touched.store(now(), memory_order_relaxed);
+
+    return &it->second;
+}
+
+/* ================================================================
+ * read_entry
+ * Copies the stored tuple of entry into env, reading it straight from
+ * the segment if it is spilled and inflating it if it is compressed.
+ * Leaves the entry as it is, so it is safe under the read lock.
+ */
+ERL_NIF_TERM NeuralEnvEngine::read_entry(ErlNifEnv *env, TableEntry &entry) {
+    ERL_NIF_TERM ret = entry.term;
+
+    if (entry.spilled() && !segment.read(env, entry.spill_offset, entry.spill_size, ret)) {
+        return enif_make_atom(env, "undefined");
+    }
+    if (entry.compressed()) {
+        if (!inflate_term(env, ret, entry.raw_size, ret)) {
+            return enif_make_atom(env, "undefined");
+        }
+        return ret;
+    }
+    if (!entry.spilled()) {
+        ret = enif_make_copy(env, ret);
+    }
+
+    return ret;
+}
+
+/* ================================================================
+ * fault
+ * Reads a spilled entry back into the bucket env, or an env of its
+ * own if the record is large. Its segment record becomes dead space,
+ * to be dropped by the next compaction.
+ */
+void NeuralEnvEngine::fault(unsigned long int key, TableEntry &entry) {
+    ErlNifEnv *env = home(entry, key, entry.spill_size);
+
+    if (!segment.read(env, entry.spill_offset, entry.spill_size, entry.term)) {
+        // Nothing sensible left to hand out; keep the key readable.
+        printf("[neural_tier] Can't read spilled entry from %s\r\n", segment.get_path().c_str());
+        entry.term = enif_make_atom(env, "undefined");
+    }
+
+    segment.release(entry.spill_size);
+    entry.spill_offset = -1;
+    entry.spill_size = 0;
+}
+
+/* ================================================================
+ * spill
+ * Writes a resident entry to the segment and hands its term over to
+ * the garbage collector. Only the index stub remains in memory.
+ */
+void NeuralEnvEngine::spill(unsigned long int key, TableEntry &entry) {
+    unsigned int len = 0;
+    long int offset;
+
+    offset = segment.append(bucket_env, entry.term, len);
+    if (offset < 0) {
+        return;
+    }
+
+    if (entry.large()) {
+        drop_large(entry, key);
+    } else if (!retire(entry)) {
+        discard(key, entry.term);
+    }
+    entry.spill_offset = offset;
+    entry.spill_size = len;
+}
+
+/* ================================================================
+ * compress
+ * Replaces the term of an idle entry with its compressed external
+ * format. Entries that are too small, or that compress badly, are
+ * flagged so later sweeps do not try again until they are rewritten.
+ */
+void NeuralEnvEngine::compress(unsigned long int key, TableEntry &entry) {
+    ERL_NIF_TERM packed;
+    unsigned int raw_size = 0;
+
+    if (estimate_size(bucket_env, entry.term) < compress_size || !compress_term(bucket_env, entry.term, packed, raw_size)) {
+        entry.flags |= ENTRY_INCOMPRESSIBLE;
+        return;
+    }
+
+    if (entry.large()) {
+        drop_large(entry, key);
+    } else if (!retire(entry)) {
+        discard(key, entry.term);
+    }
+    entry.term = packed;
+    entry.raw_size = raw_size;
+    entry.flags |= ENTRY_COMPRESSED;
+}
+
+/* ================================================================
+ * inflate
+ * Replaces the term of a compressed entry with the tuple it holds.
+ * A compressed entry faulted in from the segment may own the env the
+ * packed term is in; that env is dropped, which leaves the packed
+ * term readable until the next write, and the tuple is homed by its
+ * own size.
+ */
+void NeuralEnvEngine::inflate(unsigned long int key, TableEntry &entry) {
+    ERL_NIF_TERM packed = entry.term, unpacked;
+    ErlNifEnv *env;
+
+    drop_large(entry, key);
+    env = home(entry, key, entry.raw_size);
+
+    if (!inflate_term(env, packed, entry.raw_size, unpacked)) {
+        printf("[neural_compress] Can't inflate compressed entry\r\n");
+        unpacked = enif_make_atom(env, "undefined");
+    }
+
+    if (!retire(entry)) {
+        discard(key, packed);
+    }
+    entry.term = unpacked;
+    entry.flags &= ~ENTRY_COMPRESSED;
+}
+
+/* ================================================================
+ * home
+ * Returns the env a tuple of size bytes is to be stored in for entry:
+ * an env of its own if it is large, otherwise the bucket env.
+ */
+ErlNifEnv* NeuralEnvEngine::home(TableEntry &entry, unsigned long int key, unsigned long int size) {
+    if (large_size == 0 || size < large_size) {
+        return bucket_env;
+    }
+
+    adopt(entry, key, enif_alloc_env(), size);
+    return entry.own_env;
+}
+
+// Makes env, holding a tuple of size bytes, entry's own, dropping any
+// env the entry already had.
+void NeuralEnvEngine::adopt(TableEntry &entry, unsigned long int key, ErlNifEnv *env, unsigned long int size) {
+    drop_large(entry, key);
+    entry.own_env = env;
+    entry.own_size = size;
+    large_bytes += size;
+    ++large_count;
+}
+
+/* ================================================================
+ * drop_large
+ * Takes entry's own env away from it, to be freed by the next call
+ * that needs the write lock, once nothing can be using its term.
+ */
+void NeuralEnvEngine::drop_large(TableEntry &entry, unsigned long int key) {
+    if (!entry.large()) {
+        return;
+    }
+
+    dead.push_back(make_pair(key, entry.own_env));
+    large_bytes -= entry.own_size < large_bytes ? entry.own_size : large_bytes;
+    --large_count;
+    entry.own_env = NULL;
+    entry.own_size = 0;
+}
+
+// Also forgets the retired keys, whose discards belong to the write
+// that retired them.
+void NeuralEnvEngine::free_dead() {
+    for (size_t i = 0; i < dead.size(); ++i) {
+        enif_free_env(dead[i].second);
+    }
+    dead.clear();
+    retired.clear();
+}
+
+/* ================================================================
+ * compact_segment
+ * Rewrites the segment with only the records still referenced by
+ * the bucket.
+ */
+void NeuralEnvEngine::compact_segment() {
+    NeuralSegment fresh;
+    hash_table::iterator it;
+    vector<long int> offsets;
+
+    if (!fresh.open(segment.get_path() + ".compact")) {
+        return;
+    }
+
+    // Copy everything first so a failed write leaves the index intact.
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.spilled()) {
+            long int offset = fresh.copy(segment, it->second.spill_offset, it->second.spill_size);
+            if (offset < 0) {
+                return;
+            }
+            offsets.push_back(offset);
+        }
+    }
+
+    if (!segment.replace(fresh)) {
+        return;
+    }
+
+    vector<long int>::iterator off = offsets.begin();
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.spilled()) {
+            it->second.spill_offset = *off++;
+        }
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef NEURALENVENGINE_H
+#define NEURALENVENGINE_H
+
+#include "NeuralEngine.h"
+#include "NeuralSegment.h"
+#include "NeuralNodePool.h"
+#include "neural_utils.h"
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <string.h>
+#include <stdio.h>
+
+#define ENTRY_COMPRESSED        0x1
+#define ENTRY_INCOMPRESSIBLE    0x2
+#define ENTRY_TENURED           0x4
+
+/* A stored tuple. While an entry is spilled to its bucket's segment
+ * term is invalid, and the record is found at spill_offset instead.
+ * A compressed entry's term is a binary holding the zlib compressed
+ * external format of the tuple, raw_size bytes when inflated. A
+ * tenured entry's term lives in the old env; age counts the
+ * collections a young one has survived. A large entry's term lives in
+ * own_env, which holds nothing else, and own_size is its size.
+ */
+struct TableEntry {
+    TableEntry() : term(0), own_env(NULL), touched(0), spill_offset(-1), spill_size(0), flags(0), age(0), raw_size(0), own_size(0) { }
+    TableEntry(const TableEntry &other) { *this = other; }
+
+    TableEntry& operator=(const TableEntry &other) {
+        term = other.term;
+        own_env = other.own_env;
+        touched.store(other.touched.load(memory_order_relaxed), memory_order_relaxed);
+        spill_offset = other.spill_offset;
+        spill_size = other.spill_size;
+        flags = other.flags;
+        age = other.age;
+        raw_size = other.raw_size;
+        own_size = other.own_size;
+        return *this;
+    }
+
+    bool spilled() const { return spill_offset >= 0; }
+    bool compressed() const { return flags & ENTRY_COMPRESSED; }
+    bool tenured() const { return flags & ENTRY_TENURED; }
+    bool large() const { return own_env != NULL; }
+
+    ERL_NIF_TERM        term;
+    ErlNifEnv           *own_env;
+    atomic<unsigned int> touched;
+    long int            spill_offset;
+    unsigned int        spill_size;
+    unsigned char       flags;
+    unsigned char       age;
+    unsigned int        raw_size;
+    unsigned long int   own_size;
+};
+
+typedef NeuralPoolAllocator<pair<const unsigned long int, TableEntry> > entry_allocator;
+typedef unordered_map<unsigned long int, TableEntry, hash<unsigned long int>, equal_to<unsigned long int>, entry_allocator> hash_table;
+
+/* The entries and envs of a cleared env engine, along with the pool
+ * the entries' nodes came from.
+ */
+class EnvLeftovers : public EngineLeftovers {
+    public:
+        EnvLeftovers(NeuralNodePool *pool)
+                : pool(pool), entries(0, hash<unsigned long int>(), equal_to<unsigned long int>(), entry_allocator(pool)) { }
+        ~EnvLeftovers();
+
+        // Declared ahead of entries, which give their nodes back to it.
+        unique_ptr<NeuralNodePool> pool;
+        hash_table      entries;
+        ErlNifEnv       *bucket_env;
+        ErlNifEnv       *old_env;
+        vector<pair<unsigned long int, ErlNifEnv*> > dead;
+};
+
+/* The original engine: live terms in process independent envs,
+ * rebuilt by compact() once enough of them is garbage. Idle entries
+ * can be compressed in place or spilled to a segment file.
+ *
+ * Terms are written to a young env. Entries that go unchanged through
+ * tenure_age compactions move to an old env, which compact() only
+ * rebuilds once most of the garbage is there, so long-lived entries
+ * aren't copied over and over. A tenure_age of 0 keeps every entry
+ * young.
+ *
+ * Tuples of large_size bytes or more each get an env of their own.
+ * compact() leaves them where they are, and their env is dropped as a
+ * whole when they are replaced or erased rather than becoming garbage.
+ * Writers copy them into that env when staging, outside the lock.
+ */
+class NeuralEnvEngine : public NeuralEngine {
+    public:
+        NeuralEnvEngine(TableOptions &opts, int bucket, atomic<unsigned int> *clock);
+        ~NeuralEnvEngine();
+
+        bool contains(unsigned long int key);
+        bool resident(unsigned long int key);
+        bool read(unsigned long int key, ErlNifEnv *dest, ERL_NIF_TERM &ret);
+        void iterate(ErlNifEnv *dest, EntryVisitor visit);
+        size_t count() { return entries.size(); }
+        unsigned long int garbage() { return garbage_can; }
+        unsigned long int live();
+
+        bool stage(ErlNifEnv *env, ERL_NIF_TERM tuple, StagedTuple &ret);
+
+        ErlNifEnv* env() { return bucket_env; }
+        bool find(unsigned long int key, ERL_NIF_TERM &ret);
+        using NeuralEngine::put;
+        ERL_NIF_TERM put(unsigned long int key, StagedTuple &staged);
+        bool erase(unsigned long int key, ERL_NIF_TERM &ret);
+        void discard(unsigned long int key, ERL_NIF_TERM term);
+        unsigned long int tally(int budget);
+        void compact();
+        void sweep(unsigned int now);
+        EngineLeftovers* clear();
+
+    protected:
+        ErlNifEnv* home(TableEntry &entry, unsigned long int key, unsigned long int size);
+        void adopt(TableEntry &entry, unsigned long int key, ErlNifEnv *env, unsigned long int size);
+        void drop_large(TableEntry &entry, unsigned long int key);
+        void free_dead();
+        TableEntry* lookup(unsigned long int key);
+        ERL_NIF_TERM read_entry(ErlNifEnv *env, TableEntry &entry);
+        void fault(unsigned long int key, TableEntry &entry);
+        void spill(unsigned long int key, TableEntry &entry);
+        void compress(unsigned long int key, TableEntry &entry);
+        void inflate(unsigned long int key, TableEntry &entry);
+        void compact_segment();
+        bool retire(TableEntry &entry);
+        unsigned int now() { return clock->load(memory_order_relaxed); }
+
+        // Declared ahead of entries, which give their nodes back to it.
+        // clear() hands both off and makes new ones.
+        unique_ptr<NeuralNodePool> pool;
+        hash_table      entries;
+        ErlNifEnv       *bucket_env;
+        ErlNifEnv       *old_env;
+        unsigned long int garbage_can;
+        // The part of garbage_can left in the old env.
+        unsigned long int old_garbage;
+        // The size of the young entries as of the last compact(), and
+        // of the tenured ones.
+        unsigned long int young_size;
+        size_t          young_count;
+        unsigned long int old_size;
+        size_t          old_count;
+        unsigned int    tenure_age;
+        // Large entries: the threshold, and how many there are and
+        // what they add up to.
+        unsigned long int large_size;
+        unsigned long int large_bytes;
+        size_t          large_count;
+        // Envs of replaced or erased large entries, with their keys.
+        // Their terms may still be in use until the next write.
+        vector<pair<unsigned long int, ErlNifEnv*> > dead;
+        // Keys whose tenured term the last write retired; discard()
+        // leaves the terms it dropped alone.
+        vector<unsigned long int> retired;
+        ERL_NIF_TERM    reclaimable;
+        NeuralSegment   segment;
+        atomic<unsigned int> *clock;
+
+        bool tiered;
+        unsigned int tier_idle;
+        unsigned int compress_size;
+        unsigned int compress_idle;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "NeuralExport.h"
+#include <stdio.h>
+#include <errno.h>
+
+NeuralExport::NeuralExport() : header(NULL), slots(NULL), size(0), key_pos(1) { }
+
+NeuralExport::~NeuralExport() {
+    close();
+}
+
+/* ================================================================
+ * open
+ * Creates the segment with room for at least slots entries. Any
+ * segment left under the same name is unlinked rather than reused,
+ * so readers still attached to it never see it shrink under them.
+ */
+bool NeuralExport::open(const string &shm_name, unsigned long int slots_wanted, unsigned int kp) {
+    uint64_t bucket_slots = 1;
+    void *map;
+    int fd;
+
+    while (bucket_slots * NEURAL_SHM_BUCKETS < slots_wanted) {
+        bucket_slots <<= 1;
+    }
+
+    shm_unlink(shm_name.c_str());
+    fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        printf("[neural_export] Can't create %s. Error Code: %d\r\n", shm_name.c_str(), errno);
+        return false;
+    }
+
+    size = neural_shm_size(bucket_slots);
+    if (ftruncate(fd, size) != 0) {
+        printf("[neural_export] Can't size %s. Error Code: %d\r\n", shm_name.c_str(), errno);
+        ::close(fd);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        printf("[neural_export] Can't map %s. Error Code: %d\r\n", shm_name.c_str(), errno);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+
+    // Fresh shared memory reads as zeroes, so every slot starts free.
+    name = shm_name;
+    key_pos = kp;
+    header = (NeuralShmHeader*)map;
+    slots = (NeuralShmSlot*)(header + 1);
+    header->version = NEURAL_SHM_VERSION;
+    header->key_pos = key_pos;
+    header->bucket_slots = bucket_slots;
+    header->alive.store(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    header->magic = NEURAL_SHM_MAGIC;
+
+    return true;
+}
+
+void NeuralExport::close() {
+    if (header != NULL) {
+        header->alive.store(0, memory_order_release);
+        munmap(header, size);
+        shm_unlink(name.c_str());
+        header = NULL;
+        slots = NULL;
+    }
+}
+
+/* ================================================================
+ * put
+ * Mirrors tuple into the slot for key under the slot's seqlock. A
+ * bucket whose slots are all in use simply stops mirroring new keys.
+ */
+void NeuralExport::put(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM tuple) {
+    NeuralShmSlot *slot = probe(bucket, key, true);
+    const ERL_NIF_TERM *tpl;
+    int arity = 0;
+    ErlNifSInt64 value;
+
+    if (slot == NULL || !enif_get_tuple(env, tuple, &arity, &tpl)) {
+        return;
+    }
+
+    slot->seq.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    slot->state = NEURAL_SHM_LIVE;
+    slot->key = key;
+    slot->arity = arity;
+    slot->int_mask = 0;
+    for (int i = 0; i < arity && i < NEURAL_SHM_FIELDS; ++i) {
+        if (enif_get_int64(env, tpl[i], &value)) {
+            slot->values[i] = value;
+            slot->int_mask |= 1U << i;
+        } else {
+            slot->values[i] = 0;
+        }
+    }
+    fill_name(slot, env, arity, tpl);
+
+    slot->seq.fetch_add(1, memory_order_release);
+}
+
+void NeuralExport::erase(int bucket, unsigned long int key) {
+    NeuralShmSlot *slot = probe(bucket, key, false);
+
+    if (slot == NULL) {
+        return;
+    }
+
+    slot->seq.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->state = NEURAL_SHM_DELETED;
+    slot->seq.fetch_add(1, memory_order_release);
+}
+
+void NeuralExport::clear(int bucket) {
+    NeuralShmSlot *group;
+
+    if (header == NULL) {
+        return;
+    }
+
+    group = slots + bucket * header->bucket_slots;
+    for (uint64_t n = 0; n < header->bucket_slots; ++n) {
+        if (group[n].state == NEURAL_SHM_LIVE) {
+            group[n].seq.fetch_add(1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            group[n].state = NEURAL_SHM_DELETED;
+            group[n].seq.fetch_add(1, memory_order_release);
+        }
+    }
+}
+
+NeuralShmSlot* NeuralExport::probe(int bucket, unsigned long int key, bool insert) {
+    NeuralShmSlot *group, *reuse = NULL;
+    uint64_t mask, at;
+
+    if (header == NULL) {
+        return NULL;
+    }
+
+    group = slots + bucket * header->bucket_slots;
+    mask = header->bucket_slots - 1;
+    at = (key / NEURAL_SHM_BUCKETS) & mask;
+
+    for (uint64_t n = 0; n <= mask; ++n, at = (at + 1) & mask) {
+        NeuralShmSlot *slot = &group[at];
+        if (slot->state == NEURAL_SHM_FREE) {
+            return insert ? (reuse != NULL ? reuse : slot) : NULL;
+        }
+        if (slot->state == NEURAL_SHM_DELETED) {
+            if (reuse == NULL) { reuse = slot; }
+        } else if (slot->key == key) {
+            return slot;
+        }
+    }
+
+    return insert ? reuse : NULL;
+}
+
+// Records the key in the slot if it is a short atom, binary or string.
+void NeuralExport::fill_name(NeuralShmSlot *slot, ErlNifEnv *env, int arity, const ERL_NIF_TERM *tpl) {
+    ErlNifBinary bin;
+    ERL_NIF_TERM term;
+
+    memset(slot->name, 0, NEURAL_SHM_NAME);
+    if (key_pos < 1 || key_pos > (unsigned int)arity) {
+        return;
+    }
+    term = tpl[key_pos - 1];
+
+    if (enif_is_atom(env, term)) {
+        if (enif_get_atom(env, term, slot->name, NEURAL_SHM_NAME, ERL_NIF_LATIN1) <= 0) {
+            memset(slot->name, 0, NEURAL_SHM_NAME);
+        }
+    } else if (enif_is_binary(env, term)) {
+        if (enif_inspect_binary(env, term, &bin) && bin.size < NEURAL_SHM_NAME) {
+            memcpy(slot->name, bin.data, bin.size);
+        }
+    } else if (enif_is_list(env, term)) {
+        if (enif_get_string(env, term, slot->name, NEURAL_SHM_NAME, ERL_NIF_LATIN1) <= 0) {
+            memset(slot->name, 0, NEURAL_SHM_NAME);
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef NEURALEXPORT_H
+#define NEURALEXPORT_H
+
+#include "erl_nif.h"
+#include "neural_shm.h"
+#include <string>
+
+using namespace std;
+
+/* Writes the integer fields of a table's tuples into a POSIX shared
+ * memory segment laid out as described in neural_shm.h. Each bucket
+ * owns its own group of slots, so callers holding a bucket's write
+ * lock are the only writers to that group.
+ */
+class NeuralExport {
+    public:
+        NeuralExport();
+        ~NeuralExport();
+
+        bool open(const string &shm_name, unsigned long int slots, unsigned int key_pos);
+        void close();
+
+        void put(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM tuple);
+        void erase(int bucket, unsigned long int key);
+        void clear(int bucket);
+
+    protected:
+        NeuralShmSlot* probe(int bucket, unsigned long int key, bool insert);
+        void fill_name(NeuralShmSlot *slot, ErlNifEnv *env, int arity, const ERL_NIF_TERM *tpl);
+
+        string name;
+        NeuralShmHeader *header;
+        NeuralShmSlot *slots;
+        size_t size;
+        unsigned int key_pos;
+};
+
+#endif
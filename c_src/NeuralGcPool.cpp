@@ -0,0 +1,158 @@
+#include "NeuralGcPool.h"
+#include <stdio.h>
+
+NeuralGcPool::NeuralGcPool() : stopping(false) {
+    ErlNifSysInfo info;
+    ErlNifTid tid;
+    int n, ret;
+
+    mutex = enif_mutex_create("neural_gc_pool");
+    cond = enif_cond_create("neural_gc_pool");
+    done_cond = enif_cond_create("neural_gc_pool_done");
+
+    enif_system_info(&info, sizeof(info));
+    n = info.scheduler_threads / 2 > 0 ? info.scheduler_threads / 2 : 1;
+    for (int i = 0; i < n; ++i) {
+        ret = enif_thread_create("neural_gc_worker", &tid, NeuralGcPool::Work, (void*)this, NULL);
+        if (ret != 0) {
+            printf("[neural_gc] Can't create GC worker. Error Code: %d\r\n", ret);
+            break;
+        }
+        threads.push_back(tid);
+    }
+}
+
+NeuralGcPool::~NeuralGcPool() {
+    enif_mutex_lock(mutex);
+    stopping = true;
+    enif_cond_broadcast(cond);
+    enif_mutex_unlock(mutex);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        enif_thread_join(threads[i], NULL);
+    }
+    while (!jobs.empty()) {
+        jobs.front()();
+        jobs.pop_front();
+    }
+
+    enif_cond_destroy(done_cond);
+    enif_cond_destroy(cond);
+    enif_mutex_destroy(mutex);
+}
+
+/* ================================================================
+ * run
+ * Calls task(0) .. task(tasks - 1), at most limit of them at a time.
+ */
+void NeuralGcPool::run(int tasks, unsigned int limit, GcTask task) {
+    Batch batch;
+    unsigned int helpers = limit > 1 ? limit - 1 : 0;
+    int done;
+
+    if (helpers > threads.size()) {
+        helpers = threads.size();
+    }
+    if (helpers > (unsigned int)tasks) {
+        helpers = tasks;
+    }
+
+    batch.task = task;
+    batch.count = tasks;
+    batch.next.store(0, memory_order_relaxed);
+    batch.done = 0;
+    batch.helpers = 0;
+
+    if (helpers > 0) {
+        enif_mutex_lock(mutex);
+        for (unsigned int i = 0; i < helpers; ++i) {
+            queue.push_back(&batch);
+        }
+        enif_cond_broadcast(cond);
+        enif_mutex_unlock(mutex);
+    }
+
+    done = drain(&batch);
+
+    enif_mutex_lock(mutex);
+    batch.done += done;
+    // Helpers that never got to the batch must not find it later.
+    for (deque<Batch*>::iterator it = queue.begin(); it != queue.end();) {
+        it = *it == &batch ? queue.erase(it) : it + 1;
+    }
+    while (batch.done < batch.count || batch.helpers > 0) {
+        enif_cond_wait(done_cond, mutex);
+    }
+    enif_mutex_unlock(mutex);
+}
+
+/* ================================================================
+ * post
+ * Queues job for a pool thread and returns without waiting for it.
+ * Without threads, job runs right away.
+ */
+void NeuralGcPool::post(GcJob job) {
+    if (threads.empty()) {
+        job();
+        return;
+    }
+
+    enif_mutex_lock(mutex);
+    jobs.push_back(job);
+    enif_cond_signal(cond);
+    enif_mutex_unlock(mutex);
+}
+
+// Runs tasks of batch until none are left to start, and returns how
+// many it ran.
+int NeuralGcPool::drain(Batch *batch) {
+    int n, done = 0;
+
+    while ((n = batch->next.fetch_add(1, memory_order_relaxed)) < batch->count) {
+        batch->task(n);
+        ++done;
+    }
+
+    return done;
+}
+
+void* NeuralGcPool::Work(void *arg) {
+    NeuralGcPool *pool = (NeuralGcPool*)arg;
+    Batch *batch;
+    GcJob job;
+    int done;
+
+    enif_mutex_lock(pool->mutex);
+    while (true) {
+        while (!pool->stopping && pool->queue.empty() && pool->jobs.empty()) {
+            enif_cond_wait(pool->cond, pool->mutex);
+        }
+        if (pool->stopping) {
+            break;
+        }
+        if (pool->queue.empty()) {
+            job = pool->jobs.front();
+            pool->jobs.pop_front();
+
+            enif_mutex_unlock(pool->mutex);
+            job();
+            enif_mutex_lock(pool->mutex);
+            continue;
+        }
+        batch = pool->queue.front();
+        pool->queue.pop_front();
+        ++batch->helpers;
+
+        enif_mutex_unlock(pool->mutex);
+        done = pool->drain(batch);
+        enif_mutex_lock(pool->mutex);
+
+        // The batch is gone once its caller sees this.
+        batch->done += done;
+        --batch->helpers;
+        enif_cond_broadcast(pool->done_cond);
+    }
+    enif_mutex_unlock(pool->mutex);
+
+    return NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef NEURALGCPOOL_H
+#define NEURALGCPOOL_H
+
+#include "erl_nif.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+typedef function<void(int task)> GcTask;
+typedef function<void()> GcJob;
+
+/* Threads shared by every table for collecting buckets in parallel.
+ * A caller hands run() a number of tasks and works on them itself
+ * while up to limit - 1 pool threads help; run() returns once all of
+ * them are done. The pool has half as many threads as the emulator
+ * has schedulers, so however many tables collect at once, garbage
+ * collection leaves most of the machine to the schedulers.
+ */
+class NeuralGcPool {
+    public:
+        NeuralGcPool();
+        ~NeuralGcPool();
+
+        void run(int tasks, unsigned int limit, GcTask task);
+        void post(GcJob job);
+        unsigned int size() { return threads.size(); }
+
+    protected:
+        // done and helpers are guarded by the pool mutex.
+        struct Batch {
+            GcTask          task;
+            int             count;
+            atomic<int>     next;
+            int             done;
+            int             helpers;
+        };
+
+        static void* Work(void *pool);
+        int drain(Batch *batch);
+
+        vector<ErlNifTid>   threads;
+        ErlNifMutex         *mutex;
+        ErlNifCond          *cond;
+        ErlNifCond          *done_cond;
+        // One entry per pool thread a batch may use.
+        deque<Batch*>       queue;
+        deque<GcJob>        jobs;
+        bool                stopping;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include "NeuralHotKeys.h"
+
+NeuralHotKeys::NeuralHotKeys() {
+    mutex = enif_mutex_create("neural_hot_keys");
+    counters.reserve(HOT_KEY_SLOTS);
+    since = enif_monotonic_time(ERL_NIF_MSEC);
+}
+
+NeuralHotKeys::~NeuralHotKeys() {
+    enif_mutex_destroy(mutex);
+}
+
+void NeuralHotKeys::touch(unsigned long int key, bool write) {
+    vector<HotKey>::iterator it, min;
+
+    enif_mutex_lock(mutex);
+    for (it = min = counters.begin(); it != counters.end(); ++it) {
+        if (it->key == key) {
+            break;
+        }
+        if (it->count < min->count) {
+            min = it;
+        }
+    }
+
+    if (it == counters.end()) {
+        if (counters.size() < HOT_KEY_SLOTS) {
+            HotKey fresh = { key, 0, 0, 0 };
+            counters.push_back(fresh);
+            it = counters.end() - 1;
+        } else {
+            it = min;
+            it->key = key;
+            it->error = it->count;
+            it->writes = 0;
+        }
+    }
+
+    ++it->count;
+    if (write) {
+        ++it->writes;
+    }
+    enif_mutex_unlock(mutex);
+}
+
+void NeuralHotKeys::wrote(unsigned long int key) {
+    vector<HotKey>::iterator it;
+
+    enif_mutex_lock(mutex);
+    for (it = counters.begin(); it != counters.end(); ++it) {
+        if (it->key == key) {
+            ++it->writes;
+            break;
+        }
+    }
+    enif_mutex_unlock(mutex);
+}
+
+/* ================================================================
+ * decay
+ * Halves the counts once they cover HOT_KEY_WINDOW. Halved counts
+ * stand for half the time they covered, so rates stay the same.
+ */
+void NeuralHotKeys::decay(ErlNifTime now) {
+    vector<HotKey>::iterator it;
+
+    enif_mutex_lock(mutex);
+    if (now - since >= HOT_KEY_WINDOW) {
+        for (it = counters.begin(); it != counters.end();) {
+            it->count /= 2;
+            it->error /= 2;
+            it->writes /= 2;
+            if (it->count == 0) {
+                it = counters.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        since = now - (now - since) / 2;
+    }
+    enif_mutex_unlock(mutex);
+}
+
+ErlNifTime NeuralHotKeys::top(vector<HotKey> &ret) {
+    ErlNifTime span;
+
+    enif_mutex_lock(mutex);
+    ret.insert(ret.end(), counters.begin(), counters.end());
+    span = enif_monotonic_time(ERL_NIF_MSEC) - since;
+    enif_mutex_unlock(mutex);
+
+    return span > 0 ? span : 1;
+}
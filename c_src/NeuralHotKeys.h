@@ -0,0 +1,49 @@
+#ifndef NEURALHOTKEYS_H
+#define NEURALHOTKEYS_H
+
+#include "erl_nif.h"
+#include <vector>
+
+#define HOT_KEY_SLOTS 16
+#define HOT_KEY_WINDOW 10000
+
+using namespace std;
+
+struct HotKey {
+    unsigned long int key;
+    unsigned long int count;     // sampled accesses, an upper bound
+    unsigned long int error;     // how much of count was inherited
+    unsigned long int writes;    // sampled writes since key was admitted
+};
+
+/* Finds the most accessed keys of one bucket with the space-saving
+ * algorithm: HOT_KEY_SLOTS counters, where a key that has none takes
+ * over the smallest, inheriting its count. Any key accessed more than
+ * 1/HOT_KEY_SLOTS of the time is guaranteed to hold a counter.
+ *
+ * Counts are halved every HOT_KEY_WINDOW milliseconds, so they follow
+ * current traffic rather than all of it. Callers sample; the tracker
+ * has its own mutex, as sampled reads only hold the bucket read lock.
+ */
+class NeuralHotKeys {
+    public:
+        NeuralHotKeys();
+        ~NeuralHotKeys();
+
+        // Counts an access to key, and a write if write is set.
+        void touch(unsigned long int key, bool write);
+        // Counts a write to key if it is tracked. For writes whose
+        // access was already counted.
+        void wrote(unsigned long int key);
+        void decay(ErlNifTime now);
+        // Appends the tracked keys to ret and returns the milliseconds
+        // their counts cover.
+        ErlNifTime top(vector<HotKey> &ret);
+
+    protected:
+        ErlNifMutex *mutex;
+        vector<HotKey> counters;
+        ErlNifTime since;
+};
+
+#endif
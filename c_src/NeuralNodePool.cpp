@@ -0,0 +1,54 @@
+#include "NeuralNodePool.h"
+
+NeuralNodePool::~NeuralNodePool() {
+    Link *next;
+
+    while (slabs != NULL) {
+        next = slabs->next;
+        enif_free(slabs);
+        slabs = next;
+    }
+}
+
+void* NeuralNodePool::alloc(size_t bytes) {
+    size_t cls = (bytes + POOL_CLASS_SIZE - 1) / POOL_CLASS_SIZE;
+    Link *ret;
+
+    if (cls == 0 || cls > POOL_CLASSES) {
+        count_alloc();
+        return enif_alloc(bytes);
+    }
+
+    if (free_lists[cls - 1] != NULL) {
+        ret = free_lists[cls - 1];
+        free_lists[cls - 1] = ret->next;
+        return ret;
+    }
+
+    if (slab_top == NULL || slab_top + cls * POOL_CLASS_SIZE > slab_end) {
+        Link *slab = (Link*)enif_alloc(POOL_SLAB_SIZE);
+        count_alloc();
+        slab->next = slabs;
+        slabs = slab;
+        // The link takes up the first class size worth of the slab.
+        slab_top = (char*)slab + POOL_CLASS_SIZE;
+        slab_end = (char*)slab + POOL_SLAB_SIZE;
+    }
+    ret = (Link*)slab_top;
+    slab_top += cls * POOL_CLASS_SIZE;
+
+    return ret;
+}
+
+void NeuralNodePool::free(void *ptr, size_t bytes) {
+    size_t cls = (bytes + POOL_CLASS_SIZE - 1) / POOL_CLASS_SIZE;
+    Link *link = (Link*)ptr;
+
+    if (cls == 0 || cls > POOL_CLASSES) {
+        enif_free(ptr);
+        return;
+    }
+
+    link->next = free_lists[cls - 1];
+    free_lists[cls - 1] = link;
+}
@@ -0,0 +1,70 @@
+#ifndef NEURALNODEPOOL_H
+#define NEURALNODEPOOL_H
+
+#include "erl_nif.h"
+#include "neural_utils.h"
+#include <stddef.h>
+#include <type_traits>
+
+#define POOL_CLASS_SIZE 16
+#define POOL_CLASSES 16
+#define POOL_SLAB_SIZE 16384
+
+/* Keeps freed hash map nodes for reuse. Blocks of up to
+ * POOL_CLASSES * POOL_CLASS_SIZE bytes are carved out of slabs and
+ * go back on a free list of their size class when freed, so a map
+ * whose size holds steady stops allocating. Larger blocks, like the
+ * bucket arrays, go straight to enif_alloc. Slabs are only returned
+ * when the pool is destroyed.
+ *
+ * Not thread safe; the bucket lock covers the pool of a bucket.
+ */
+class NeuralNodePool {
+    public:
+        NeuralNodePool() : slabs(NULL), slab_top(NULL), slab_end(NULL) {
+            for (int i = 0; i < POOL_CLASSES; ++i) {
+                free_lists[i] = NULL;
+            }
+        }
+        ~NeuralNodePool();
+
+        void* alloc(size_t bytes);
+        void free(void *ptr, size_t bytes);
+
+    protected:
+        // Freed blocks and slabs both start with a link to the next.
+        struct Link {
+            Link *next;
+        };
+
+        Link    *free_lists[POOL_CLASSES];
+        Link    *slabs;
+        char    *slab_top;
+        char    *slab_end;
+};
+
+/* Hands a standard container's allocations to a NeuralNodePool. The
+ * pool goes along when a container is moved or swapped, so a map can
+ * be handed off with the pool its nodes came from.
+ */
+template<typename T>
+struct NeuralPoolAllocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    NeuralPoolAllocator(NeuralNodePool *pool) : pool(pool) { }
+    template<typename U> NeuralPoolAllocator(const NeuralPoolAllocator<U> &other) : pool(other.pool) { }
+
+    T* allocate(size_t n) { return (T*)pool->alloc(n * sizeof(T)); }
+    void deallocate(T *ptr, size_t n) { pool->free(ptr, n * sizeof(T)); }
+
+    NeuralNodePool *pool;
+};
+
+template<typename T, typename U>
+bool operator==(const NeuralPoolAllocator<T> &a, const NeuralPoolAllocator<U> &b) { return a.pool == b.pool; }
+template<typename T, typename U>
+bool operator!=(const NeuralPoolAllocator<T> &a, const NeuralPoolAllocator<U> &b) { return a.pool != b.pool; }
+
+#endif
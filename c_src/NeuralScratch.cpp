@@ -0,0 +1,62 @@
+#include "NeuralScratch.h"
+
+thread_local NeuralScratch::Arena NeuralScratch::arena = { NULL, 0, 0, 0, 0, NULL, 0, 0 };
+
+void* NeuralScratch::AllocBytes(size_t bytes) {
+    void *ret;
+
+    bytes = (bytes + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+    arena.want += bytes;
+
+    if (arena.top + bytes <= arena.size) {
+        ret = arena.base + arena.top;
+        arena.top += bytes;
+        return ret;
+    }
+
+    if (arena.spill_count == arena.spill_size) {
+        void **spill = (void**)enif_alloc((arena.spill_size + 8) * sizeof(void*));
+        count_alloc();
+        if (arena.spill != NULL) {
+            memcpy(spill, arena.spill, arena.spill_count * sizeof(void*));
+            enif_free(arena.spill);
+        }
+        arena.spill = spill;
+        arena.spill_size += 8;
+    }
+    ret = enif_alloc(bytes);
+    count_alloc();
+    arena.spill[arena.spill_count++] = ret;
+
+    return ret;
+}
+
+/* ================================================================
+ * Release
+ * Gives back everything allocated since mark. Blocks that didn't fit
+ * are only freed by the outermost scope, which also grows the block
+ * if they were needed.
+ */
+void NeuralScratch::Release(size_t mark) {
+    arena.top = mark;
+    if (--arena.depth > 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < arena.spill_count; ++i) {
+        enif_free(arena.spill[i]);
+    }
+    if (arena.spill_count > 0 || arena.base == NULL) {
+        arena.size = arena.size > 0 ? arena.size : SCRATCH_INITIAL_SIZE;
+        while (arena.size < arena.want) {
+            arena.size *= 2;
+        }
+        if (arena.base != NULL) {
+            enif_free(arena.base);
+        }
+        arena.base = (char*)enif_alloc(arena.size);
+        count_alloc();
+    }
+    arena.spill_count = 0;
+    arena.want = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef NEURALSCRATCH_H
+#define NEURALSCRATCH_H
+
+#include "erl_nif.h"
+#include "neural_utils.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SCRATCH_ALIGN 16
+#define SCRATCH_INITIAL_SIZE 4096
+
+/* Per-thread bump allocator for buffers that only live for one op.
+ * Memory handed out by Alloc() stays valid until the innermost
+ * NeuralScratch::Scope around the call ends, which gives all of it
+ * back at once.
+ *
+ * Each thread has one block. What doesn't fit in it is allocated on
+ * its own, and once the outermost scope ends the block is grown to
+ * fit everything that was needed, so a thread running ops of the same
+ * shapes stops allocating after its first few.
+ */
+class NeuralScratch {
+    public:
+        class Scope {
+            public:
+                Scope() : mark(arena.top) { ++arena.depth; }
+                ~Scope() { Release(mark); }
+
+            protected:
+                size_t mark;
+        };
+
+        // Room for n objects of type T, uninitialized.
+        template<typename T> static T* Alloc(size_t n) {
+            return (T*)AllocBytes(n * sizeof(T));
+        }
+
+    protected:
+        // Plain data, as thread_local objects with destructors would
+        // have to be torn down by threads the emulator owns.
+        struct Arena {
+            char    *base;
+            size_t  size;
+            size_t  top;
+            // Bytes the last outermost scope used, blocks included.
+            size_t  want;
+            int     depth;
+            // Allocations that didn't fit, freed by the outermost scope.
+            void    **spill;
+            size_t  spill_count;
+            size_t  spill_size;
+        };
+
+        static thread_local Arena arena;
+
+        static void* AllocBytes(size_t bytes);
+        static void Release(size_t mark);
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "NeuralSegment.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Segments are never compacted below this many dead bytes.
+#define SEGMENT_MIN_WASTE 1048576
+
+NeuralSegment::NeuralSegment() : fd(-1), size(0), dead(0) { }
+
+NeuralSegment::~NeuralSegment() {
+    close();
+}
+
+/* ================================================================
+ * open
+ * Creates an empty segment at file, discarding whatever was there.
+ * Spilled entries are a cache of the in-memory table, so nothing in
+ * an old segment outlives the table that wrote it.
+ */
+bool NeuralSegment::open(const string &file) {
+    close();
+
+    fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        printf("[neural_tier] Can't open segment %s. Error Code: %d\r\n", file.c_str(), errno);
+        return false;
+    }
+
+    path = file;
+    size = 0;
+    dead = 0;
+
+    return true;
+}
+
+void NeuralSegment::close() {
+    if (fd >= 0) {
+        ::close(fd);
+        unlink(path.c_str());
+        fd = -1;
+    }
+}
+
+/* ================================================================
+ * append
+ * Serializes term to the end of the segment. Returns the offset of
+ * the new record and stores its length in len, or returns -1 if the
+ * record could not be written.
+ */
+long int NeuralSegment::append(ErlNifEnv *env, ERL_NIF_TERM term, unsigned int &len) {
+    ErlNifBinary bin;
+    long int offset = size;
+
+    if (fd < 0 || !enif_term_to_binary(env, term, &bin)) {
+        return -1;
+    }
+
+    if (!write(bin.data, bin.size)) {
+        enif_release_binary(&bin);
+        return -1;
+    }
+
+    len = bin.size;
+    enif_release_binary(&bin);
+
+    return offset;
+}
+
+/* ================================================================
+ * copy
+ * Appends a record of src to this segment without decoding it. Used
+ * when compacting a segment into a fresh file.
+ */
+long int NeuralSegment::copy(NeuralSegment &src, long int offset, unsigned int len) {
+    unsigned char *data = (unsigned char*)enif_alloc(len);
+    long int ret = size;
+
+    if (!src.read_raw(data, offset, len) || !write(data, len)) {
+        ret = -1;
+    }
+    enif_free(data);
+
+    return ret;
+}
+
+bool NeuralSegment::read(ErlNifEnv *env, long int offset, unsigned int len, ERL_NIF_TERM &ret) {
+    unsigned char *data = (unsigned char*)enif_alloc(len);
+    bool ok = read_raw(data, offset, len) && enif_binary_to_term(env, data, len, &ret, 0) > 0;
+
+    enif_free(data);
+
+    return ok;
+}
+
+/* ================================================================
+ * replace
+ * Takes over the file of fresh, a compacted copy of this segment,
+ * and moves it to this segment's path.
+ */
+bool NeuralSegment::replace(NeuralSegment &fresh) {
+    if (rename(fresh.path.c_str(), path.c_str()) != 0) {
+        return false;
+    }
+
+    ::close(fd);
+    fd = fresh.fd;
+    size = fresh.size;
+    dead = 0;
+    fresh.fd = -1;
+
+    return true;
+}
+
+// Marks a record as no longer referenced by the index.
+void NeuralSegment::release(unsigned int len) {
+    dead += len;
+}
+
+void NeuralSegment::truncate() {
+    if (fd >= 0 && ftruncate(fd, 0) == 0) {
+        size = 0;
+        dead = 0;
+    }
+}
+
+// A segment is worth compacting once most of it is dead.
+bool NeuralSegment::wasteful() {
+    return dead >= SEGMENT_MIN_WASTE && dead * 2 > size;
+}
+
+bool NeuralSegment::write(const unsigned char *data, unsigned int len) {
+    unsigned int done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = pwrite(fd, data + done, len - done, size + done);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        done += n;
+    }
+    size += len;
+
+    return true;
+}
+
+bool NeuralSegment::read_raw(unsigned char *data, long int offset, unsigned int len) {
+    unsigned int done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = pread(fd, data + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) { continue; }
+        if (n <= 0) { return false; }
+        done += n;
+    }
+
+    return true;
+}
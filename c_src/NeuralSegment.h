@@ -0,0 +1,43 @@
+#ifndef NEURALSEGMENT_H
+#define NEURALSEGMENT_H
+
+#include "erl_nif.h"
+#include <string>
+
+using namespace std;
+
+/* An append-only file of serialized terms. Records are addressed by
+ * offset and size, which the owner keeps in its own index. A segment
+ * is not thread safe; callers must hold the lock of the bucket that
+ * owns it.
+ */
+class NeuralSegment {
+    public:
+        NeuralSegment();
+        ~NeuralSegment();
+
+        bool open(const string &file);
+        void close();
+        long int append(ErlNifEnv *env, ERL_NIF_TERM term, unsigned int &len);
+        long int copy(NeuralSegment &src, long int offset, unsigned int len);
+        bool read(ErlNifEnv *env, long int offset, unsigned int len, ERL_NIF_TERM &ret);
+        bool replace(NeuralSegment &fresh);
+        void release(unsigned int len);
+        void truncate();
+        bool wasteful();
+
+        const string& get_path() { return path; }
+        unsigned long int get_size() { return size; }
+        unsigned long int get_dead() { return dead; }
+
+    protected:
+        bool write(const unsigned char *data, unsigned int len);
+        bool read_raw(unsigned char *data, long int offset, unsigned int len);
+
+        int fd;
+        string path;
+        unsigned long int size;
+        unsigned long int dead;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "NeuralSerialEngine.h"
+
+NeuralSerialEngine::NeuralSerialEngine() {
+    scratch = enif_alloc_env();
+    scratch_size = 0;
+    record_size = 0;
+}
+
+NeuralSerialEngine::~NeuralSerialEngine() {
+    enif_free_env(scratch);
+}
+
+bool NeuralSerialEngine::contains(unsigned long int key) {
+    return records.find(key) != records.end();
+}
+
+bool NeuralSerialEngine::read(unsigned long int key, ErlNifEnv *dest, ERL_NIF_TERM &ret) {
+    record_table::iterator it = records.find(key);
+    return it != records.end() && decode(it->second, dest, ret);
+}
+
+void NeuralSerialEngine::iterate(ErlNifEnv *dest, EntryVisitor visit) {
+    ERL_NIF_TERM term;
+
+    for (record_table::iterator it = records.begin(); it != records.end(); ++it) {
+        if (decode(it->second, dest, term)) {
+            visit(it->first, term);
+        }
+    }
+}
+
+bool NeuralSerialEngine::find(unsigned long int key, ERL_NIF_TERM &ret) {
+    record_table::iterator it = records.find(key);
+    if (it == records.end() || !decode(it->second, scratch, ret)) {
+        return false;
+    }
+    // Decoded terms cost roughly their encoded size.
+    scratch_size += it->second.size();
+    return true;
+}
+
+bool NeuralSerialEngine::stage(ErlNifEnv *env, ERL_NIF_TERM tuple, StagedTuple &ret) {
+    ErlNifBinary bin;
+
+    ret.term = tuple;
+    if (!enif_term_to_binary(env, tuple, &bin)) {
+        return false;
+    }
+    ret.record.assign((const char*)bin.data, bin.size);
+    enif_release_binary(&bin);
+
+    return true;
+}
+
+ERL_NIF_TERM NeuralSerialEngine::put(unsigned long int key, StagedTuple &staged) {
+    string &record = records[key];
+    record_size += staged.record.size() - record.size();
+    record.swap(staged.record);
+
+    return staged.term;
+}
+
+bool NeuralSerialEngine::erase(unsigned long int key, ERL_NIF_TERM &ret) {
+    if (!find(key, ret)) {
+        return false;
+    }
+    record_size -= records[key].size();
+    records.erase(key);
+    return true;
+}
+
+void NeuralSerialEngine::compact() {
+    enif_clear_env(scratch);
+    scratch_size = 0;
+}
+
+EngineLeftovers* NeuralSerialEngine::clear() {
+    SerialLeftovers *ret = new SerialLeftovers(scratch);
+
+    ret->records.swap(records);
+    scratch = enif_alloc_env();
+    scratch_size = 0;
+    record_size = 0;
+
+    return ret;
+}
+
+bool NeuralSerialEngine::decode(const string &record, ErlNifEnv *env, ERL_NIF_TERM &ret) {
+    return enif_binary_to_term(env, (const unsigned char*)record.data(), record.size(), &ret, 0) > 0;
+}
@@ -0,0 +1,62 @@
+#ifndef NEURALSERIALENGINE_H
+#define NEURALSERIALENGINE_H
+
+#include "NeuralEngine.h"
+#include <unordered_map>
+#include <string>
+#include <stdio.h>
+
+typedef unordered_map<unsigned long int, string> record_table;
+
+/* The records and scratch env of a cleared serial engine. */
+class SerialLeftovers : public EngineLeftovers {
+    public:
+        SerialLeftovers(ErlNifEnv *scratch) : scratch(scratch) { }
+        ~SerialLeftovers() { enif_free_env(scratch); }
+
+        record_table    records;
+        ErlNifEnv       *scratch;
+};
+
+/* Keeps every tuple in external term format, so stored entries make
+ * no garbage at all and cost their encoded size. Lookups decode into
+ * the caller's env; terms the write path needs are decoded into a
+ * scratch env, which compact() simply clears. Tuples are encoded when
+ * they are staged, before the write takes the bucket lock.
+ */
+class NeuralSerialEngine : public NeuralEngine {
+    public:
+        NeuralSerialEngine();
+        ~NeuralSerialEngine();
+
+        bool contains(unsigned long int key);
+        bool resident(unsigned long int) { return true; }
+        bool read(unsigned long int key, ErlNifEnv *dest, ERL_NIF_TERM &ret);
+        void iterate(ErlNifEnv *dest, EntryVisitor visit);
+        size_t count() { return records.size(); }
+        unsigned long int garbage() { return scratch_size; }
+        unsigned long int live() { return record_size; }
+
+        bool stage(ErlNifEnv *env, ERL_NIF_TERM tuple, StagedTuple &ret);
+
+        ErlNifEnv* env() { return scratch; }
+        bool find(unsigned long int key, ERL_NIF_TERM &ret);
+        using NeuralEngine::put;
+        ERL_NIF_TERM put(unsigned long int key, StagedTuple &staged);
+        bool erase(unsigned long int key, ERL_NIF_TERM &ret);
+        void discard(unsigned long int, ERL_NIF_TERM) { }
+        unsigned long int tally(int) { return scratch_size; }
+        void compact();
+        void sweep(unsigned int) { }
+        EngineLeftovers* clear();
+
+    protected:
+        bool decode(const string &record, ErlNifEnv *env, ERL_NIF_TERM &ret);
+
+        record_table        records;
+        ErlNifEnv           *scratch;
+        unsigned long int   scratch_size;
+        unsigned long int   record_size;
+};
+
+#endif
@@ -0,0 +1,519 @@
+#include "NeuralStore.h"
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#define STORE_PAGE 4096
+#define STORE_ALIGN(n) (((n) + 7) & ~7ULL)
+#define BLOCK_SIZE(cap) (sizeof(uint64_t) + (cap) * sizeof(StoreSlot))
+#define SLOT_FREE 0
+#define SLOT_DELETED 1
+
+static uint32_t record_crc(uint64_t key, const unsigned char *data, uint32_t len) {
+    uLong crc = crc32(0L, (const Bytef*)&key, sizeof(key));
+    return crc32(crc, data, len);
+}
+
+NeuralStore::NeuralStore() : fd(-1), base(NULL), header(NULL), file_size(0), heap_mutex(NULL) { }
+
+NeuralStore::~NeuralStore() {
+    close();
+}
+
+/* ================================================================
+ * open
+ * Maps file, creating and formatting it if it is empty. An existing
+ * file is reattached without reading its entries: only the header
+ * and the bucket index descriptors are checked here. Records are
+ * verified against their slot checksum when they are first read.
+ */
+bool NeuralStore::open(const string &file, unsigned int key_pos) {
+    struct stat st;
+    void *map;
+
+    fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("[neural_store] Can't open %s. Error Code: %d\r\n", file.c_str(), errno);
+        close();
+        return false;
+    }
+
+    // Reserve the largest possible mapping up front so that growing
+    // the file never moves it and pointers into it stay valid.
+    map = mmap(NULL, STORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("[neural_store] Can't map %s. Error Code: %d\r\n", file.c_str(), errno);
+        close();
+        return false;
+    }
+
+    path = file;
+    base = (unsigned char*)map;
+    header = (StoreHeader*)base;
+    file_size = st.st_size;
+    heap_mutex = enif_mutex_create("neural_store_heap");
+    dead_bytes = 0;
+
+    if (file_size == 0) {
+        if (!format(key_pos)) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    if (file_size < STORE_PAGE
+            || header->magic != STORE_MAGIC
+            || header->version != STORE_VERSION
+            || header->buckets != STORE_BUCKETS
+            || header->crc != header_crc(header)
+            || (header->clean && header->tail > file_size)) {
+        printf("[neural_store] %s is not a valid store\r\n", file.c_str());
+        close();
+        return false;
+    }
+
+    if (header->key_pos != key_pos) {
+        printf("[neural_store] %s was written with key position %u\r\n", file.c_str(), header->key_pos);
+        close();
+        return false;
+    }
+
+    // After a crash the tail may be older than what was allocated
+    // from the heap, so never hand out space below the end of file.
+    if (!header->clean) {
+        header->tail = file_size;
+    }
+
+    for (int i = 0; i < STORE_BUCKETS; ++i) {
+        uint64_t offset = header->index[i] >> 8;
+        uint64_t capacity = 1ULL << (header->index[i] & 0xff);
+        if (offset < STORE_PAGE || offset + BLOCK_SIZE(capacity) > file_size) {
+            printf("[neural_store] %s has a corrupt index\r\n", file.c_str());
+            close();
+            return false;
+        }
+    }
+
+    dead_bytes = header->dead;
+
+    return true;
+}
+
+void NeuralStore::close() {
+    if (base != NULL) {
+        munmap(base, STORE_MAX_SIZE);
+        base = NULL;
+        header = NULL;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    if (heap_mutex != NULL) {
+        enif_mutex_destroy(heap_mutex);
+        heap_mutex = NULL;
+    }
+}
+
+bool NeuralStore::get(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM &ret) {
+    StoreSlot *slot = probe(bucket, key, false);
+
+    if (slot == NULL || slot->offset + slot->len > file_size) {
+        return false;
+    }
+
+    if (record_crc(key, base + slot->offset, slot->len) != slot->crc) {
+        printf("[neural_store] Discarding torn record in %s\r\n", path.c_str());
+        return false;
+    }
+
+    return enif_binary_to_term(env, base + slot->offset, slot->len, &ret, 0) > 0;
+}
+
+bool NeuralStore::contains(int bucket, unsigned long int key) {
+    return probe(bucket, key, false) != NULL;
+}
+
+/* ================================================================
+ * put
+ * Appends the external format of term to the heap and points the
+ * key's slot at it. The previous record, if any, becomes dead space.
+ */
+bool NeuralStore::put(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM term) {
+    ErlNifBinary bin;
+    StoreBlock *blk;
+    StoreSlot *slot;
+    unsigned int capacity = 0;
+    uint64_t offset;
+
+    blk = block(bucket, capacity);
+    if ((blk->used + 1) * 4 > capacity * 3 && !grow(bucket)) {
+        return false;
+    }
+
+    if (!enif_term_to_binary(env, term, &bin)) {
+        return false;
+    }
+
+    offset = alloc(bin.size);
+    if (offset == 0) {
+        enif_release_binary(&bin);
+        return false;
+    }
+    memcpy(base + offset, bin.data, bin.size);
+
+    blk = block(bucket, capacity);
+    slot = probe(bucket, key, true);
+    if (slot->offset > SLOT_DELETED) {
+        dead_bytes.fetch_add(slot->len, memory_order_relaxed);
+    } else if (slot->offset == SLOT_FREE) {
+        blk->used++;
+    }
+
+    slot->key = key;
+    slot->len = bin.size;
+    slot->crc = record_crc(key, bin.data, bin.size);
+    slot->offset = offset;
+
+    enif_release_binary(&bin);
+
+    return true;
+}
+
+bool NeuralStore::erase(int bucket, unsigned long int key) {
+    StoreSlot *slot = probe(bucket, key, false);
+
+    if (slot == NULL) {
+        return false;
+    }
+
+    dirty();
+    dead_bytes.fetch_add(slot->len, memory_order_relaxed);
+    slot->offset = SLOT_DELETED;
+
+    return true;
+}
+
+void NeuralStore::clear(int bucket) {
+    unsigned int capacity = 0;
+    StoreBlock *blk = block(bucket, capacity);
+
+    dirty();
+    for (unsigned int i = 0; i < capacity; ++i) {
+        if (blk->slots[i].offset > SLOT_DELETED) {
+            dead_bytes.fetch_add(blk->slots[i].len, memory_order_relaxed);
+        }
+    }
+    memset(blk->slots, 0, capacity * sizeof(StoreSlot));
+    blk->used = 0;
+}
+
+void NeuralStore::keys(int bucket, vector<unsigned long int> &ret) {
+    unsigned int capacity = 0;
+    StoreBlock *blk = block(bucket, capacity);
+
+    for (unsigned int i = 0; i < capacity; ++i) {
+        if (blk->slots[i].offset > SLOT_DELETED) {
+            ret.push_back(blk->slots[i].key);
+        }
+    }
+}
+
+/* ================================================================
+ * checkpoint
+ * Flushes every write made so far and marks the file clean. A file
+ * reopened clean is trusted as is; one that is not may contain torn
+ * records from after its last checkpoint, which are dropped when
+ * they fail verification.
+ */
+bool NeuralStore::checkpoint() {
+    bool ok;
+
+    enif_mutex_lock(heap_mutex);
+    header->dead = dead_bytes.load(memory_order_relaxed);
+    ok = msync(base, header->tail, MS_SYNC) == 0;
+    if (ok) {
+        header->clean = 1;
+        header->generation++;
+        ok = msync(base, STORE_PAGE, MS_SYNC) == 0;
+    }
+    enif_mutex_unlock(heap_mutex);
+
+    return ok;
+}
+
+/* ================================================================
+ * compact
+ * Rewrites the store into a fresh file holding only live records
+ * and right-sized index blocks, maps it, and only then renames it
+ * over the old one and drops the old mapping.
+ */
+bool NeuralStore::compact() {
+    string tmp = path + ".compact";
+    StoreHeader fresh = *header;
+    uint64_t pos = STORE_PAGE;
+    void *map = MAP_FAILED;
+    int nfd;
+    bool ok = true;
+
+    nfd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (nfd < 0) {
+        return false;
+    }
+
+    for (int i = 0; i < STORE_BUCKETS && ok; ++i) {
+        unsigned int capacity = 0,
+                     fresh_capacity = STORE_INDEX_MIN,
+                     shift = 0,
+                     live = 0;
+        StoreBlock *blk = block(i, capacity);
+        uint64_t block_offset;
+
+        for (unsigned int n = 0; n < capacity; ++n) {
+            if (blk->slots[n].offset > SLOT_DELETED) { ++live; }
+        }
+        while (fresh_capacity < live * 2) { fresh_capacity <<= 1; }
+        while ((1U << shift) < fresh_capacity) { ++shift; }
+
+        vector<StoreSlot> slots(fresh_capacity);
+        memset(&slots[0], 0, fresh_capacity * sizeof(StoreSlot));
+        block_offset = pos;
+        pos += STORE_ALIGN(BLOCK_SIZE(fresh_capacity));
+
+        for (unsigned int n = 0; n < capacity && ok; ++n) {
+            StoreSlot &slot = blk->slots[n];
+            if (slot.offset <= SLOT_DELETED) { continue; }
+
+            unsigned int at = (slot.key / STORE_BUCKETS) & (fresh_capacity - 1);
+            while (slots[at].offset != SLOT_FREE) { at = (at + 1) & (fresh_capacity - 1); }
+            slots[at] = slot;
+            slots[at].offset = pos;
+
+            ok = pwrite(nfd, base + slot.offset, slot.len, pos) == (ssize_t)slot.len;
+            pos += STORE_ALIGN(slot.len);
+        }
+
+        uint64_t used = live;
+        ok = ok && pwrite(nfd, &used, sizeof(used), block_offset) == sizeof(used)
+                && pwrite(nfd, &slots[0], fresh_capacity * sizeof(StoreSlot), block_offset + sizeof(used))
+                    == (ssize_t)(fresh_capacity * sizeof(StoreSlot));
+        fresh.index[i] = (block_offset << 8) | shift;
+    }
+
+    uint64_t fresh_size = (pos + STORE_GROW_STEP - 1) / STORE_GROW_STEP * STORE_GROW_STEP;
+
+    fresh.tail = pos;
+    fresh.dead = 0;
+    fresh.clean = 1;
+    fresh.generation++;
+    ok = ok && ftruncate(nfd, fresh_size) == 0;
+
+    if (ok) {
+        ok = pwrite(nfd, &fresh, sizeof(fresh), 0) == sizeof(fresh) && fsync(nfd) == 0;
+    }
+
+    // Map the new file before it replaces the old one, so that a
+    // failure leaves the store as it was.
+    if (ok) {
+        map = mmap(NULL, STORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, nfd, 0);
+        if (map == MAP_FAILED) {
+            printf("[neural_store] Can't map %s. Error Code: %d\r\n", tmp.c_str(), errno);
+            ok = false;
+        }
+    }
+
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        if (map != MAP_FAILED) {
+            munmap(map, STORE_MAX_SIZE);
+        }
+        ::close(nfd);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    // Every bucket is locked, so nothing holds a pointer into the old
+    // mapping.
+    munmap(base, STORE_MAX_SIZE);
+    base = (unsigned char*)map;
+    header = (StoreHeader*)base;
+    ::close(fd);
+    fd = nfd;
+    file_size = fresh_size;
+    dead_bytes.store(0, memory_order_relaxed);
+
+    return true;
+}
+
+// A store is worth compacting once most of its heap is dead.
+bool NeuralStore::wasteful() {
+    uint64_t dead = dead_bytes.load(memory_order_relaxed);
+    return dead >= STORE_MIN_WASTE && dead * 2 > header->tail;
+}
+
+/* ================================================================
+ * probe
+ * Finds the slot for key in its bucket's index. With insert set, a
+ * missing key yields the slot it should be written to instead.
+ */
+StoreSlot* NeuralStore::probe(int bucket, unsigned long int key, bool insert) {
+    unsigned int capacity = 0;
+    StoreBlock *blk = block(bucket, capacity);
+    StoreSlot *reuse = NULL;
+    unsigned int at = (key / STORE_BUCKETS) & (capacity - 1);
+
+    for (unsigned int n = 0; n < capacity; ++n, at = (at + 1) & (capacity - 1)) {
+        StoreSlot *slot = &blk->slots[at];
+        if (slot->offset == SLOT_FREE) {
+            return insert ? (reuse != NULL ? reuse : slot) : NULL;
+        }
+        if (slot->offset == SLOT_DELETED) {
+            if (reuse == NULL) { reuse = slot; }
+        } else if (slot->key == key) {
+            return slot;
+        }
+    }
+
+    return insert ? reuse : NULL;
+}
+
+StoreBlock* NeuralStore::block(int bucket, unsigned int &capacity) {
+    uint64_t desc = header->index[bucket];
+    capacity = 1U << (desc & 0xff);
+    return (StoreBlock*)(base + (desc >> 8));
+}
+
+/* ================================================================
+ * grow
+ * Moves a bucket's index to a block twice the size of its live slot
+ * count. The new block is synced before the descriptor is switched,
+ * so a crash leaves either the old or the new index in place.
+ */
+bool NeuralStore::grow(int bucket) {
+    unsigned int capacity = 0,
+                 fresh_capacity = STORE_INDEX_MIN,
+                 shift = 0,
+                 live = 0;
+    StoreBlock *blk = block(bucket, capacity),
+               *fresh;
+    uint64_t offset, page;
+
+    for (unsigned int n = 0; n < capacity; ++n) {
+        if (blk->slots[n].offset > SLOT_DELETED) { ++live; }
+    }
+    while (fresh_capacity < (live + 1) * 2) { fresh_capacity <<= 1; }
+    while ((1U << shift) < fresh_capacity) { ++shift; }
+
+    offset = alloc(BLOCK_SIZE(fresh_capacity));
+    if (offset == 0) {
+        return false;
+    }
+
+    fresh = (StoreBlock*)(base + offset);
+    memset(fresh, 0, BLOCK_SIZE(fresh_capacity));
+    for (unsigned int n = 0; n < capacity; ++n) {
+        StoreSlot &slot = blk->slots[n];
+        if (slot.offset <= SLOT_DELETED) { continue; }
+
+        unsigned int at = (slot.key / STORE_BUCKETS) & (fresh_capacity - 1);
+        while (fresh->slots[at].offset != SLOT_FREE) { at = (at + 1) & (fresh_capacity - 1); }
+        fresh->slots[at] = slot;
+    }
+    fresh->used = live;
+
+    page = offset & ~(uint64_t)(STORE_PAGE - 1);
+    msync(base + page, offset + BLOCK_SIZE(fresh_capacity) - page, MS_SYNC);
+
+    header->index[bucket] = (offset << 8) | shift;
+    dead_bytes.fetch_add(BLOCK_SIZE(capacity), memory_order_relaxed);
+
+    return true;
+}
+
+/* ================================================================
+ * alloc
+ * Carves len bytes off the end of the heap, growing the file when
+ * needed. Returns 0 when the store is full.
+ */
+uint64_t NeuralStore::alloc(uint64_t len) {
+    uint64_t offset = 0;
+
+    enif_mutex_lock(heap_mutex);
+    if (header->tail + len <= file_size || extend(header->tail + len)) {
+        offset = header->tail;
+        header->tail += STORE_ALIGN(len);
+        if (header->clean) {
+            header->clean = 0;
+            msync(base, STORE_PAGE, MS_SYNC);
+        }
+    }
+    enif_mutex_unlock(heap_mutex);
+
+    if (offset == 0) {
+        printf("[neural_store] %s is full\r\n", path.c_str());
+    }
+
+    return offset;
+}
+
+bool NeuralStore::extend(uint64_t size) {
+    uint64_t fresh_size = (size + STORE_GROW_STEP - 1) / STORE_GROW_STEP * STORE_GROW_STEP;
+
+    if (fresh_size > STORE_MAX_SIZE || ftruncate(fd, fresh_size) != 0) {
+        return false;
+    }
+    file_size = fresh_size;
+
+    return true;
+}
+
+// Marks the file as modified since its last checkpoint.
+void NeuralStore::dirty() {
+    enif_mutex_lock(heap_mutex);
+    if (header->clean) {
+        header->clean = 0;
+        msync(base, STORE_PAGE, MS_SYNC);
+    }
+    enif_mutex_unlock(heap_mutex);
+}
+
+// Covers the fields fixed when the file is formatted. The rest of the
+// header changes with every write and is checked on its own by open().
+uint32_t NeuralStore::header_crc(const StoreHeader *hdr) {
+    return crc32(0L, (const Bytef*)hdr, offsetof(StoreHeader, clean));
+}
+
+bool NeuralStore::format(unsigned int key_pos) {
+    uint64_t pos = STORE_PAGE;
+
+    if (!extend(STORE_GROW_STEP)) {
+        printf("[neural_store] Can't size %s. Error Code: %d\r\n", path.c_str(), errno);
+        return false;
+    }
+
+    memset(header, 0, sizeof(StoreHeader));
+    header->magic = STORE_MAGIC;
+    header->version = STORE_VERSION;
+    header->buckets = STORE_BUCKETS;
+    header->key_pos = key_pos;
+
+    // Fresh file space reads as zeroes, so every index starts empty.
+    for (int i = 0; i < STORE_BUCKETS; ++i) {
+        unsigned int shift = 0;
+        while ((1U << shift) < STORE_INDEX_MIN) { ++shift; }
+        header->index[i] = (pos << 8) | shift;
+        pos += STORE_ALIGN(BLOCK_SIZE(STORE_INDEX_MIN));
+    }
+
+    header->tail = pos;
+    header->clean = 1;
+    header->crc = header_crc(header);
+
+    return msync(base, STORE_PAGE, MS_SYNC) == 0;
+}
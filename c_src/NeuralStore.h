@@ -0,0 +1,101 @@
+#ifndef NEURALSTORE_H
+#define NEURALSTORE_H
+
+#include "erl_nif.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <stdint.h>
+
+#define STORE_MAGIC 0x31534c4152554e45ULL
+#define STORE_VERSION 2
+#define STORE_BUCKETS 64
+#define STORE_MAX_SIZE (1ULL << 36)
+#define STORE_GROW_STEP (1ULL << 24)
+#define STORE_INDEX_MIN 64
+#define STORE_MIN_WASTE (1ULL << 24)
+
+using namespace std;
+
+/* The first page of a store file. index[] holds one descriptor per
+ * bucket, (block offset << 8) | log2(capacity), so that moving a
+ * bucket to a bigger index block is a single aligned store. crc only
+ * covers the fields ahead of clean, which never change once the file
+ * is formatted; open() range checks the index and trusts tail only
+ * when the file is clean.
+ */
+struct StoreHeader {
+    uint64_t    magic;
+    uint32_t    version;
+    uint32_t    buckets;
+    uint32_t    key_pos;
+    uint32_t    clean;
+    uint64_t    tail;
+    uint64_t    dead;
+    uint64_t    generation;
+    uint32_t    crc;
+    uint32_t    pad;
+    uint64_t    index[STORE_BUCKETS];
+};
+
+/* An index slot. offset is 0 for a free slot and 1 for a deleted
+ * one. crc covers the key and the record bytes, so a slot torn by a
+ * crash, or one pointing at a torn record, never verifies.
+ */
+struct StoreSlot {
+    uint64_t    key;
+    uint64_t    offset;
+    uint32_t    len;
+    uint32_t    crc;
+};
+
+struct StoreBlock {
+    uint64_t    used;
+    StoreSlot   slots[1];
+};
+
+/* A file-backed, memory mapped store of serialized entries with a
+ * persistent hash index per bucket. Bucket operations must be called
+ * with that bucket locked by the caller; allocation from the shared
+ * heap is serialized internally. checkpoint() and compact() must be
+ * called with every bucket locked.
+ */
+class NeuralStore {
+    public:
+        NeuralStore();
+        ~NeuralStore();
+
+        bool open(const string &file, unsigned int key_pos);
+        void close();
+
+        bool get(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM &ret);
+        bool contains(int bucket, unsigned long int key);
+        bool put(int bucket, unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM term);
+        bool erase(int bucket, unsigned long int key);
+        void clear(int bucket);
+        void keys(int bucket, vector<unsigned long int> &ret);
+
+        bool checkpoint();
+        bool compact();
+        bool wasteful();
+
+    protected:
+        StoreSlot* probe(int bucket, unsigned long int key, bool insert);
+        StoreBlock* block(int bucket, unsigned int &capacity);
+        bool grow(int bucket);
+        uint64_t alloc(uint64_t len);
+        bool extend(uint64_t size);
+        void dirty();
+        bool format(unsigned int key_pos);
+        static uint32_t header_crc(const StoreHeader *hdr);
+
+        int fd;
+        string path;
+        unsigned char *base;
+        StoreHeader *header;
+        uint64_t file_size;
+        atomic<uint64_t> dead_bytes;
+        ErlNifMutex *heap_mutex;
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "NeuralTable.h"
+
+#if STORE_BUCKETS != BUCKET_COUNT
+#error "NeuralStore must index as many buckets as NeuralTable has"
+#endif
 /* !!!! A NOTE ON KEYS !!!!
  * Keys should be integer values passed from the erlang emulator, 
  * and should be generated by a hashing function. There is no easy 
@@ -15,647 +19,206 @@
 
 table_set NeuralTable::tables;
 atomic<bool> NeuralTable::running(true);
-ErlNifMutex *NeuralTable::table_mutex;
+bool NeuralTable::dirty_fallback;
+ErlNifRWLock *NeuralTable::table_lock;
+ErlNifMutex *NeuralTable::table_maker;
+NeuralGcPool *NeuralTable::gc_pool;
+
+NeuralTable::NeuralTable(TableOptions &opts) {
+    name = opts.name;
+    key_pos = opts.key_pos;
+    store = opts.store;
+    exporter = opts.exporter;
+    tracer = NULL;
+    if (opts.trace_sample > 0 || opts.trace_slow > 0) {
+        tracer = new NeuralTraceRing(opts.trace_size, opts.trace_sample, opts.trace_slow * 1000);
+    }
+    hot_sample = opts.hot_sample;
+    set_gc_policy(opts.gc);
+    gc_adaptive_bytes.store(GC_DEFAULT_BYTES, memory_order_relaxed);
+    gc_last.store(enif_monotonic_time(ERL_NIF_MSEC), memory_order_relaxed);
+    gc_freed.store(0, memory_order_relaxed);
+    gc_paused.store(false, memory_order_relaxed);
+    garbage_seen.store(0, memory_order_relaxed);
+    cold_clock.store(enif_monotonic_time(ERL_NIF_SEC), memory_order_relaxed);
 
-NeuralTable::NeuralTable(unsigned int kp) {
     for (int i = 0;  i < BUCKET_COUNT; ++i) {
-        ErlNifEnv *env = enif_alloc_env();
-        env_buckets[i] = env;
+        engines[i] = NeuralEngine::Create(opts, i, &cold_clock);
         locks[i] = enif_rwlock_create("neural_table");
-        garbage_cans[i] = 0;
-        reclaimable[i] = enif_make_list(env, 0);
-    }
+        loaded[i] = store == NULL;
+        hot_keys[i] = hot_sample > 0 ? new NeuralHotKeys() : NULL;
+        gc_stats[i].runs.store(0, memory_order_relaxed);
+        gc_stats[i].micros.store(0, memory_order_relaxed);
+        gc_stats[i].reclaimed.store(0, memory_order_relaxed);
+        stats[i].ops.store(0, memory_order_relaxed);
+        stats[i].hits.store(0, memory_order_relaxed);
+        stats[i].misses.store(0, memory_order_relaxed);
+        stats[i].lock_waits.store(0, memory_order_relaxed);
+        stats[i].throttled.store(0, memory_order_relaxed);
+        stats[i].rejected.store(0, memory_order_relaxed);
+        stats[i].rescheduled.store(0, memory_order_relaxed);
+    }
+    subscriber_mutex = enif_mutex_create("neural_table_telemetry");
 
     start_gc();
     start_batch();
 
-    key_pos = kp;
+    // Warm the table up from its store without holding up traffic.
+    if (store != NULL) {
+        ErlNifPid nobody = ErlNifPid();
+        add_batch_job(nobody, &NeuralTable::batch_load, "load");
+    }
 }
 
 NeuralTable::~NeuralTable() {
     stop_batch();
     stop_gc();
+    if (store != NULL) {
+        store->checkpoint();
+        delete store;
+    }
+    delete exporter;
+    delete tracer;
+    enif_mutex_destroy(subscriber_mutex);
     for (int i = 0; i < BUCKET_COUNT; ++i) {
         enif_rwlock_destroy(locks[i]);
-        enif_free_env(env_buckets[i]);
+        delete engines[i];
+        delete hot_keys[i];
     }
 }
 
 /* ================================================================
  * MakeTable
- * Allocates a new table, assuming a unique atom identifier. This
- * table is stored in a static container. All interactions with
- * the table must be performed through the static class API.
+ * Allocates a new table, assuming a unique name. This table is
+ * stored in a static container under the atom it is named by.
+ * Returns false if the name is taken, or if the store or export
+ * named in opts can't be opened.
  */
-ERL_NIF_TERM NeuralTable::MakeTable(ErlNifEnv *env, ERL_NIF_TERM name, ERL_NIF_TERM key_pos) {
-    char *atom;
-    string key;
-    unsigned int len = 0,
-                 pos = 0;
-    ERL_NIF_TERM ret;
-
-    // Allocate space for the name of the table
-    enif_get_atom_length(env, name, &len, ERL_NIF_LATIN1);
-    atom = (char*)enif_alloc(len + 1);
-
-    // Fetch the value of the atom and store it in a string (because I can, that's why)
-    enif_get_atom(env, name, atom, len + 1, ERL_NIF_LATIN1);
-    key = atom;
+bool NeuralTable::MakeTable(ERL_NIF_TERM atom, TableOptions &opts) {
+    NeuralTable *tb;
+    bool ret = false;
 
-    // Deallocate that space
-    enif_free(atom);
+    // Only MakeTable adds tables, so under table_maker the name stays
+    // free while the store and export are opened. Lookups of other
+    // tables don't wait for that file I/O; only the insert takes
+    // table_lock.
+    enif_mutex_lock(table_maker);
+    if (GetTable(atom) != NULL) {
+        // Table already exists? Bad monkey!
+        enif_mutex_unlock(table_maker);
+        return false;
+    }
 
-    // Get the key position value
-    enif_get_uint(env, key_pos, &pos);
+    if (!opts.persist_path.empty()) {
+        opts.store = new NeuralStore();
+    }
+    if (!opts.export_name.empty()) {
+        opts.exporter = new NeuralExport();
+    }
 
-    enif_mutex_lock(table_mutex);
-    if (NeuralTable::tables.find(key) != NeuralTable::tables.end()) { 
-        // Table already exists? Bad monkey!
-        ret = enif_make_badarg(env); 
+    if ((opts.store != NULL && !opts.store->open(opts.persist_path, opts.key_pos))
+            || (opts.exporter != NULL && !opts.exporter->open(opts.export_name, opts.export_slots, opts.key_pos))) {
+        // Couldn't create or reattach to the store file, or create
+        // the shared memory segment.
+        delete opts.store;
+        delete opts.exporter;
     } else {
         // All good. Make the table
-        NeuralTable::tables[key] = new NeuralTable(pos);
-        ret = enif_make_atom(env, "ok");
+        tb = new NeuralTable(opts);
+        enif_rwlock_rwlock(table_lock);
+        NeuralTable::tables[atom] = tb;
+        enif_rwlock_rwunlock(table_lock);
+        ret = true;
     }
-    enif_mutex_unlock(table_mutex);
+    enif_mutex_unlock(table_maker);
 
     return ret;
 }
 
 /* ================================================================
  * GetTable
- * Retrieves a handle to the table referenced by name, assuming
- * such a table exists. If not, throw badarg.
+ * Retrieves a handle to the table named by the atom name, or NULL if
+ * there is no such table. Atoms are unique, so the term itself is the
+ * key and finding a table never copies or hashes its name.
  */
-NeuralTable* NeuralTable::GetTable(ErlNifEnv *env, ERL_NIF_TERM name) {
-    char *atom = NULL;
-    string key;
-    unsigned len = 0;
+NeuralTable* NeuralTable::GetTable(ERL_NIF_TERM name) {
     NeuralTable *ret = NULL;
     table_set::const_iterator it;
 
-    // Allocate space for the table name
-    enif_get_atom_length(env, name, &len, ERL_NIF_LATIN1);
-    atom = (char*)enif_alloc(len + 1);
-
-    // Copy the table name into a string
-    enif_get_atom(env, name, atom, len + 1, ERL_NIF_LATIN1);
-    key = atom;
-    
-    // Deallocate that space
-    enif_free(atom);
-
-    // Look for the table and return its pointer if found
-    it = NeuralTable::tables.find(key);
+    // MakeTable may be rehashing the map under us otherwise.
+    enif_rwlock_rlock(table_lock);
+    it = NeuralTable::tables.find(name);
     if (it != NeuralTable::tables.end()) { 
         ret = it->second;
     }
+    enif_rwlock_runlock(table_lock);
 
     return ret;
 }
 
 /* ================================================================
- * Insert
- * Inserts a tuple into the table with key. 
+ * clear
+ * Empties every bucket. All of them are locked first, so that this
+ * is an isolated operation. The engines only swap what they hold for
+ * new, empty structures while locked; the old ones are freed on the
+ * GC pool afterwards, so the pause doesn't grow with the table.
  */
-ERL_NIF_TERM NeuralTable::Insert(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM object) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old;
-    unsigned long int entry_key = 0;
+void NeuralTable::clear() {
+    EngineLeftovers *leftovers[BUCKET_COUNT];
+    int n = 0;
 
-    // Grab table or bail.
-    tb = GetTable(env, table);
-    if (tb == NULL) { 
-        return enif_make_badarg(env); 
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        enif_rwlock_rwlock(locks[n]);
     }
 
-    // Get key value.
-    enif_get_ulong(env, key, &entry_key);
-
-    // Lock the key.
-    tb->rwlock(entry_key);
-
-    // Attempt to lookup the value. If nonempty, increment
-    // discarded term counter and return a copy of the
-    // old value
-    if (tb->find(entry_key, old)) {
-        tb->reclaim(entry_key, old);
-        ret = enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_copy(env, old));
-    } else {
-        ret = enif_make_atom(env, "ok");
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        leftovers[n] = clear_bucket(n);
     }
-    
-    // Write that shit out
-    tb->put(entry_key, object);
-
-    // Oh, and unlock the key if you would.
-    tb->rwunlock(entry_key);
-
-    return ret;
-}
 
-/* ================================================================
- * InsertNew
- * Inserts a tuple into the table with key, assuming there is not
- * a value with key already. Returns true if there was no value
- * for key, or false if there was.
- */
-ERL_NIF_TERM NeuralTable::InsertNew(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM object) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old;
-    unsigned long int entry_key = 0;
-
-    // Get the table or bail
-    tb = GetTable(env, table);
-    if (tb == NULL) {
-        return enif_make_badarg(env);
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        enif_rwlock_rwunlock(locks[n]);
     }
 
-    // Get the key value
-    enif_get_ulong(env, key, &entry_key);
-
-    // Get write lock for the key
-    tb->rwlock(entry_key);
-
-    if (tb->find(entry_key, old)) {
-        // Key was found. Return false and do not insert
-        ret = enif_make_atom(env, "false");
-    } else {
-        // Key was not found. Return true and insert
-        tb->put(entry_key, object);
-        ret = enif_make_atom(env, "true");
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        free_later(leftovers[n]);
     }
-
-    // Release write lock for the key
-    tb->rwunlock(entry_key);
-
-    return ret;
 }
 
-/* ================================================================
- * Increment
- * Processes a list of update operations. Each operation specifies
- * a position in the stored tuple to update and an integer to add
- * to it.
- */
-ERL_NIF_TERM NeuralTable::Increment(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old;
-    ERL_NIF_TERM it;
-    unsigned long int entry_key = 0;
-
-    // Get table handle or bail
-    tb = GetTable(env, table);
-    if (tb == NULL) {
-        return enif_make_badarg(env);
-    }
-
-    // Get key value
-    enif_get_ulong(env, key, &entry_key);
-
-    // Acquire read/write lock for key
-    tb->rwlock(entry_key);
-
-    // Try to read the value as it is
-    if (tb->find(entry_key, old)) {
-        // Value exists
-        ERL_NIF_TERM op_cell;
-        const ERL_NIF_TERM *tb_tpl;
-        const ERL_NIF_TERM *op_tpl;
-        ERL_NIF_TERM *new_tpl;
-        ErlNifEnv *bucket_env = tb->get_env(entry_key);
-        unsigned long int   pos         = 0;
-        long int            incr        = 0;
-        unsigned int        ops_length  = 0;
-        int                 op_arity    = 0,
-                            tb_arity    = 0;
-
-        // Expand tuple to work on elements
-        enif_get_tuple(bucket_env, old, &tb_arity, &tb_tpl);
-
-        // Allocate space for a copy the contents of the table
-        // tuple and copy it in. All changes are to be made to
-        // the copy of the tuple.
-        new_tpl = (ERL_NIF_TERM*)enif_alloc(sizeof(ERL_NIF_TERM) * tb_arity);
-        memcpy(new_tpl, tb_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
-
-        // Create empty list cell for return value.
-        ret = enif_make_list(env, 0);
-
-        // Set iterator to first cell of ops
-        it = ops;
-        while(!enif_is_empty_list(env, it)) {
-            long int value = 0;
-            enif_get_list_cell(env, it, &op_cell, &it);             // op_cell = hd(it), it = tl(it)
-            enif_get_tuple(env, op_cell, &op_arity, &op_tpl);       // op_arity = tuple_size(op_cell), op_tpl = [TplPos1, TplPos2]
-            enif_get_ulong(env, op_tpl[0], &pos);                   // pos = (uint64)op_tpl[0]
-            enif_get_long(env, op_tpl[1], &incr);                   // incr = (uint64)op_tpl[1]
-
-            // Is the operation trying to modify a nonexistant
-            // position?
-            if (pos <= 0 || pos > tb_arity) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-
-            // Is the operation trying to add to a value that's
-            // not a number?
-            if (!enif_is_number(bucket_env, new_tpl[pos - 1])) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-
-            // Update the value stored in the tuple.
-            enif_get_long(env, new_tpl[pos - 1], &value);
-            tb->reclaim(entry_key, new_tpl[pos - 1]);
-            new_tpl[pos - 1] = enif_make_long(bucket_env, value + incr);
-
-            // Copy the new value to the head of the return list
-            ret = enif_make_list_cell(env, enif_make_copy(env, new_tpl[pos - 1]), ret);
-        }
-
-        tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity));
+// Returns what the bucket's engine held, for free_later().
+EngineLeftovers* NeuralTable::clear_bucket(int bucket) {
+    EngineLeftovers *ret = engines[bucket]->clear();
 
-        // Bailout allows cancelling the update opertion
-        // in case something goes wrong. It must always 
-        // come after tb->put and before enif_free and
-        // rwunlock
-bailout:
-        enif_free(new_tpl);
-    } else {
-        ret = enif_make_badarg(env);
+    if (store != NULL) {
+        store->clear(bucket);
+    }
+    loaded[bucket] = true;
+    if (exporter != NULL) {
+        exporter->clear(bucket);
     }
-    // Release the rwlock for entry_key
-    tb->rwunlock(entry_key);
 
     return ret;
 }
 
 /* ================================================================
- * Unshift
- * Processes a list of update operations. Each update operation is
- * a tuple specifying the position of a list in the stored value to 
- * update and a list of values to append. Elements are shifted from
- * the input list to the stored list, so:
- *
- * unshift([a,b,c,d]) results in [d,c,b,a]
+ * checkpoint
+ * Flushes a persistent table to disk. Writers are held off for the
+ * duration so that everything written before the call is covered.
  */
-ERL_NIF_TERM NeuralTable::Unshift(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old, it;
-    unsigned long int entry_key;
-    ErlNifEnv *bucket_env;
-
-    tb = GetTable(env, table);
-    if (tb == NULL) {
-        return enif_make_badarg(env);
-    }
-
-    enif_get_ulong(env, key, &entry_key);
-
-    tb->rwlock(entry_key);
-    bucket_env = tb->get_env(entry_key);
-    if (tb->find(entry_key, old)) {
-        const ERL_NIF_TERM  *old_tpl,
-                            *op_tpl;
-        ERL_NIF_TERM        *new_tpl;
-        int tb_arity = 0,
-            op_arity = 0;
-        unsigned long pos = 0;
-        unsigned int new_length = 0;
-        ERL_NIF_TERM op,
-                     unshift,
-                     copy_it,
-                     copy_val;
-
-        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
-        new_tpl = (ERL_NIF_TERM*)enif_alloc(sizeof(ERL_NIF_TERM) * tb_arity);
-        memcpy(new_tpl, old_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
-
-        it = ops;
-        ret = enif_make_list(env, 0);
-
-        while (!enif_is_empty_list(env, it)) {
-            // Examine the operation.
-            enif_get_list_cell(env, it, &op, &it);          // op = hd(it), it = tl(it)
-            enif_get_tuple(env, op, &op_arity, &op_tpl);    // op_arity = tuple_size(op), op_tpl = [TplPos1, TplPos2]
-            enif_get_ulong(env, op_tpl[0], &pos);           // Tuple position to modify
-            unshift = op_tpl[1];                            // Values to unshfit
-
-            // Argument 1 of the operation tuple is position;
-            // make sure it's within the bounds of the tuple
-            // in the table.
-            if (pos <= 0 || pos > tb_arity) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-            
-            // Make sure we were passed a list of things to push
-            // onto the posth element of the entry
-            if (!enif_is_list(env, unshift)) {
-                ret = enif_make_badarg(env);
-            }
-
-            // Now iterate over unshift, moving its values to
-            // the head of new_tpl[pos - 1] one by one
-            copy_it = unshift;
-            while (!enif_is_empty_list(env, copy_it)) {
-                enif_get_list_cell(env, copy_it, &copy_val, &copy_it);
-                new_tpl[pos - 1] = enif_make_list_cell(bucket_env, enif_make_copy(bucket_env, copy_val), new_tpl[pos - 1]);
-            }
-            enif_get_list_length(bucket_env, new_tpl[pos - 1], &new_length);
-            ret = enif_make_list_cell(env, enif_make_uint(env, new_length), ret);
-        }
-
-        tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity));
-
-bailout:
-        enif_free(new_tpl);
-    } else {
-        ret = enif_make_badarg(env);
-    }
-    tb->rwunlock(entry_key);
-
-    return ret;
-}
-
-ERL_NIF_TERM NeuralTable::Shift(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old, it;
-    unsigned long int entry_key;
-    ErlNifEnv *bucket_env;
-
-    tb = GetTable(env, table);
-    if (tb == NULL) {
-        return enif_make_badarg(env);
-    }
-
-    enif_get_ulong(env, key, &entry_key);
-
-    tb->rwlock(entry_key);
-    bucket_env = tb->get_env(entry_key);
-    if (tb->find(entry_key, old)) {
-        const ERL_NIF_TERM *old_tpl;
-        const ERL_NIF_TERM *op_tpl;
-        ERL_NIF_TERM *new_tpl;
-        int tb_arity = 0,
-            op_arity = 0;
-        unsigned long pos = 0,
-                      count = 0;
-        ERL_NIF_TERM op, list, shifted, reclaim;
-
-        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
-        new_tpl = (ERL_NIF_TERM*)enif_alloc(tb_arity * sizeof(ERL_NIF_TERM));
-        memcpy(new_tpl, old_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
-
-        it = ops;
-        ret = enif_make_list(env, 0);
-        reclaim = enif_make_list(bucket_env, 0);
-
-        while(!enif_is_empty_list(env, it)) {
-            enif_get_list_cell(env, it, &op, &it);
-            enif_get_tuple(env, op, &op_arity, &op_tpl);
-            enif_get_ulong(env, op_tpl[0], &pos);
-            enif_get_ulong(env, op_tpl[1], &count);
-
-            if (pos <= 0 || pos > tb_arity) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-
-            if (!enif_is_list(env, new_tpl[pos -1])) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-
-            shifted = enif_make_list(env, 0);
-            if (count > 0) {
-                ERL_NIF_TERM copy_it = new_tpl[pos - 1],
-                             val;
-                int i = 0;
-                while (i < count && !enif_is_empty_list(bucket_env, copy_it)) {
-                    enif_get_list_cell(bucket_env, copy_it, &val, &copy_it);
-                    ++i;
-                    shifted = enif_make_list_cell(env, enif_make_copy(env, val), shifted);
-                    reclaim = enif_make_list_cell(env, val, reclaim);
-                }
-                new_tpl[pos - 1] = copy_it;
-            } else if (count < 0) {
-                ERL_NIF_TERM copy_it = new_tpl[pos - 1],
-                             val;
-                while (!enif_is_empty_list(bucket_env, copy_it)) {
-                    enif_get_list_cell(bucket_env, copy_it, &val, &copy_it);
-                    shifted = enif_make_list_cell(env, enif_make_copy(env, val), shifted);
-                    reclaim = enif_make_list_cell(env, val, reclaim);
-                }
-                new_tpl[pos - 1] = copy_it;
-            }
-            ret = enif_make_list_cell(env, shifted, ret);
-        }
-
-        tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity));
-        tb->reclaim(entry_key, reclaim);
-bailout:
-        enif_free(new_tpl);
-    } else {
-        ret = enif_make_badarg(env);
-    }
-    tb->rwunlock(entry_key);
-
-    return ret;
-}
-
-ERL_NIF_TERM NeuralTable::Swap(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, old, it;
-    unsigned long int entry_key;
-    ErlNifEnv *bucket_env;
-
-    tb = GetTable(env, table);
-    if (tb == NULL) {
-        return enif_make_badarg(env);
-    }
-
-    enif_get_ulong(env, key, &entry_key);
-
-    tb->rwlock(entry_key);
-    bucket_env = tb->get_env(entry_key);
-    if (tb->find(entry_key, old)) {
-        const ERL_NIF_TERM *old_tpl;
-        const ERL_NIF_TERM *op_tpl;
-        ERL_NIF_TERM *new_tpl;
-        int tb_arity = 0,
-            op_arity = 0;
-        unsigned long pos = 0;
-        ERL_NIF_TERM op, list, shifted, reclaim;
-
-        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
-        new_tpl = (ERL_NIF_TERM*)enif_alloc(tb_arity * sizeof(ERL_NIF_TERM));
-        memcpy(new_tpl, old_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
-
-        it = ops;
-        ret = enif_make_list(env, 0);
-        reclaim = enif_make_list(bucket_env, 0);
-
-        while (!enif_is_empty_list(env, it)) {
-            enif_get_list_cell(env, it, &op, &it);
-            enif_get_tuple(env, op, &op_arity, &op_tpl);
-            enif_get_ulong(env, op_tpl[0], &pos);
-
-            if (pos <= 0 || pos > tb_arity) {
-                ret = enif_make_badarg(env);
-                goto bailout;
-            }
-
-            reclaim = enif_make_list_cell(bucket_env, new_tpl[pos - 1], reclaim);
-            ret = enif_make_list_cell(env, enif_make_copy(env, new_tpl[pos -1]), ret);
-            new_tpl[pos - 1] = enif_make_copy(bucket_env, op_tpl[1]);
-        }
-
-        tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity));
-        tb->reclaim(entry_key, reclaim);
-bailout:
-        enif_free(new_tpl);
-    } else {
-        ret = enif_make_badarg(env);
-    }
-    tb->rwunlock(entry_key);
-
-    return ret;
-}
-
-ERL_NIF_TERM NeuralTable::Delete(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key) {
-    NeuralTable *tb;
-    ERL_NIF_TERM val, ret;
-    unsigned long int entry_key;
-
-    tb = GetTable(env, table);
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    enif_get_ulong(env, key, &entry_key);
-
-    tb->rwlock(entry_key);
-
-    if (tb->erase(entry_key, val)) {
-        tb->reclaim(entry_key, val);
-        ret = enif_make_copy(env, val);
-    } else {
-        ret = enif_make_atom(env, "undefined");
-    }
-
-    tb->rwunlock(entry_key);
-
-    return ret;
-}
-
-ERL_NIF_TERM NeuralTable::Empty(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb;
-    int n = 0;
-
-    tb = GetTable(env, table);
-    if (tb == NULL) { return enif_make_badarg(env); }
+bool NeuralTable::checkpoint() {
+    bool ok;
+    int n;
 
-    // First, lock EVERY bucket. We want this to be an isolated operation.
     for (n = 0; n < BUCKET_COUNT; ++n) {
-        enif_rwlock_rwlock(tb->locks[n]);
+        enif_rwlock_rlock(locks[n]);
     }
 
-    // Now clear the table
-    for (n = 0; n < BUCKET_COUNT; ++n) {
-        tb->hash_buckets[n].clear();
-        enif_clear_env(tb->env_buckets[n]);
-        tb->garbage_cans[n] = 0;
-        tb->reclaimable[n] = enif_make_list(tb->env_buckets[n], 0);
-    }
+    ok = store->checkpoint();
 
-    // Now unlock every bucket.
     for (n = 0; n < BUCKET_COUNT; ++n) {
-        enif_rwlock_rwunlock(tb->locks[n]);
+        enif_rwlock_runlock(locks[n]);
     }
 
-    return enif_make_atom(env, "ok");
-}
-
-ERL_NIF_TERM NeuralTable::Get(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key) {
-    NeuralTable *tb;
-    ERL_NIF_TERM ret, val;
-    unsigned long int entry_key;
-
-    // Acquire table handle, or quit if the table doesn't exist.
-    tb = GetTable(env, table);
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    // Get key value
-    enif_get_ulong(env, key, &entry_key);
-
-    // Lock the key
-    tb->rlock(entry_key);
-
-    // Read current value
-    if (!tb->find(entry_key, val)) {
-        ret = enif_make_atom(env, "undefined");
-    } else {
-        ret = enif_make_copy(env, val);
-    }
-
-    tb->runlock(entry_key);
-
-    return ret;
-}
-
-ERL_NIF_TERM NeuralTable::Dump(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb = GetTable(env, table);
-    ErlNifPid self;
-    ERL_NIF_TERM ret;
-
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    enif_self(env, &self);
-
-    tb->add_batch_job(self, &NeuralTable::batch_dump);
-
-    return enif_make_atom(env, "$neural_batch_wait");
-}
-
-ERL_NIF_TERM NeuralTable::Drain(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb = GetTable(env, table);
-    ErlNifPid self;
-    int ret;
-
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    enif_self(env, &self);
-
-    tb->add_batch_job(self, &NeuralTable::batch_drain);
-
-    return enif_make_atom(env, "$neural_batch_wait");
-}
-
-ERL_NIF_TERM NeuralTable::GetKeyPosition(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb = GetTable(env, table);
-
-    if (tb == NULL) { return enif_make_badarg(env); }
-    return enif_make_uint(env, tb->key_pos);
-}
-
-ERL_NIF_TERM NeuralTable::GarbageCollect(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb = GetTable(env, table);
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    enif_cond_signal(tb->gc_cond);
-
-    return enif_make_atom(env, "ok");
-}
- 
-ERL_NIF_TERM NeuralTable::GarbageSize(ErlNifEnv *env, ERL_NIF_TERM table) {
-    NeuralTable *tb = GetTable(env, table);
-    unsigned long int size = 0;
-
-    if (tb == NULL) { return enif_make_badarg(env); }
-
-    size = tb->garbage_size();
-
-    return enif_make_ulong(env, size);
+    return ok;
 }
 
 void* NeuralTable::DoGarbageCollection(void *table) {
@@ -664,7 +227,7 @@ void* NeuralTable::DoGarbageCollection(void *table) {
     enif_mutex_lock(tb->gc_mutex);
 
     while (running.load(memory_order_acquire)) {
-        while (running.load(memory_order_acquire) && tb->garbage_size() < RECLAIM_THRESHOLD) {
+        while (running.load(memory_order_acquire) && !tb->gc_due(tb->garbage_size(), tb->live_size())) {
             enif_cond_wait(tb->gc_cond, tb->gc_mutex);
         }
         tb->gc();
@@ -678,28 +241,39 @@ void* NeuralTable::DoGarbageCollection(void *table) {
 void* NeuralTable::DoReclamation(void *table) {
     const int max_eat = 5;
     NeuralTable *tb = (NeuralTable*)table;
-    int i = 0, c = 0, t = 0;;
-    ERL_NIF_TERM tl, hd;
-    ErlNifEnv *env;
+    int i = 0, sweep = 0;
+    unsigned long int garbage, live;
 
     while (running.load(memory_order_acquire)) {
-        for (i = 0; i < BUCKET_COUNT; ++i) {
-            c = 0;
-            t = 0;
-            tb->rwlock(i);
-            env = tb->get_env(i);
-            tl = tb->reclaimable[i];
-            while (c++ < max_eat && !enif_is_empty_list(env, tl)) {
-                enif_get_list_cell(env, tl, &hd, &tl);
-                tb->garbage_cans[i] += estimate_size(env, hd);
-                t += tb->garbage_cans[i];
+        tb->cold_clock.store(enif_monotonic_time(ERL_NIF_SEC), memory_order_relaxed);
+        if (++sweep >= COLD_SWEEP_INTERVAL) {
+            tb->cold_sweep();
+            if (tb->store != NULL && tb->store->wasteful()) {
+                tb->compact_store();
             }
-            tb->rwunlock(i);
-
-            if (t >= RECLAIM_THRESHOLD) {
-                enif_cond_signal(tb->gc_cond);
+            sweep = 0;
+        }
+        tb->push_telemetry();
+        if (tb->hot_sample > 0) {
+            ErlNifTime now = enif_monotonic_time(ERL_NIF_MSEC);
+            for (i = 0; i < BUCKET_COUNT; ++i) {
+                tb->hot_keys[i]->decay(now);
             }
         }
+
+        // Locks directly, like the other background work, so that
+        // lock_waits only counts what clients wait for.
+        garbage = live = 0;
+        for (i = 0; i < BUCKET_COUNT; ++i) {
+            enif_rwlock_rwlock(tb->locks[i]);
+            garbage += tb->engines[i]->tally(max_eat);
+            live += tb->engines[i]->live();
+            enif_rwlock_rwunlock(tb->locks[i]);
+        }
+        tb->garbage_seen.store(garbage, memory_order_relaxed);
+        if (tb->gc_due(garbage, live)) {
+            enif_cond_signal(tb->gc_cond);
+        }
         usleep(50000);
     }
 
@@ -715,9 +289,18 @@ void* NeuralTable::DoBatchOperations(void *table) {
         while (running.load(memory_order_acquire) && tb->batch_jobs.empty()) {
             enif_cond_wait(tb->batch_cond, tb->batch_mutex);
         }
+        if (tb->batch_jobs.empty()) {
+            break;
+        }
         BatchJob job = tb->batch_jobs.front();
-        (tb->*job.fun)(job.pid);
         tb->batch_jobs.pop();
+
+        // Jobs can run for a long time; don't hold up callers queueing more.
+        enif_mutex_unlock(tb->batch_mutex);
+        NEURAL_PROBE1(batch__start, job.name);
+        (tb->*job.fun)(job.pid, job.args);
+        NEURAL_PROBE1(batch__done, job.name);
+        enif_mutex_lock(tb->batch_mutex);
     }
 
     enif_mutex_unlock(tb->batch_mutex);
@@ -725,6 +308,37 @@ void* NeuralTable::DoBatchOperations(void *table) {
     return NULL;
 }
 
+/* ================================================================
+ * try_lock
+ * Takes the bucket lock of key if that doesn't mean putting a normal
+ * scheduler to sleep. Dirty scheduler threads, and emulators without
+ * them, just wait for it.
+ */
+bool NeuralTable::try_lock(unsigned long int key, bool write) {
+    int bucket = GET_LOCK(key);
+
+    if (!dirty_fallback || enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER) {
+        if (write) {
+            rwlock(key);
+        } else {
+            rlock(key);
+        }
+        return true;
+    }
+
+    for (int i = 0; i < LOCK_SPIN; ++i) {
+        if ((write ? enif_rwlock_tryrwlock(locks[bucket]) : enif_rwlock_tryrlock(locks[bucket])) == 0) {
+            NEURAL_PROBE2(lock__acquire, bucket, (int)write);
+            return true;
+        }
+    }
+
+    NEURAL_PROBE2(lock__contended, bucket, (int)write);
+    stats[bucket].lock_waits.fetch_add(1, memory_order_relaxed);
+    stats[bucket].rescheduled.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
 void NeuralTable::start_gc() {
     int ret;
 
@@ -767,42 +381,113 @@ void NeuralTable::stop_batch() {
     enif_thread_join(batch_tid, NULL);
 }
 
-void NeuralTable::put(unsigned long int key, ERL_NIF_TERM tuple) {
-    ErlNifEnv *env = get_env(key);
-    hash_buckets[GET_BUCKET(key)][key] = enif_make_copy(env, tuple);
+bool NeuralTable::put(unsigned long int key, ERL_NIF_TERM tuple) {
+    StagedTuple staged;
+
+    if (!stage(get_env(key), key, tuple, staged)) {
+        return false;
+    }
+
+    return put(get_env(key), key, staged);
+}
+
+/* ================================================================
+ * put
+ * Stores a tuple staged from env under key. A persistent table writes
+ * the store first and leaves the bucket alone if that fails, so a
+ * write is never acknowledged that a restart would lose.
+ */
+bool NeuralTable::put(ErlNifEnv *env, unsigned long int key, StagedTuple &staged) {
+    int bucket = GET_BUCKET(key);
+    ERL_NIF_TERM stored;
+
+    if (store != NULL && !store->put(bucket, key, staged.env != NULL ? staged.env : env, staged.term)) {
+        return false;
+    }
+    stored = engines[bucket]->put(key, staged);
+
+    sample_key(key, false, true);
+
+    if (exporter != NULL) {
+        exporter->put(bucket, key, get_env(key), stored);
+    }
+
+    return true;
 }
 
 ErlNifEnv* NeuralTable::get_env(unsigned long int key) {
-    return env_buckets[GET_BUCKET(key)];
+    return engines[GET_BUCKET(key)]->env();
 }
 
+/* ================================================================
+ * load
+ * Copies key from the store into its bucket, if its bucket has not
+ * been loaded yet and the store is the only place holding it. Needs
+ * the write lock.
+ */
+void NeuralTable::load(int bucket, unsigned long int key) {
+    ErlNifEnv *env;
+    ERL_NIF_TERM term, stored;
+
+    if (loaded[bucket] || engines[bucket]->contains(key)) {
+        return;
+    }
+
+    env = enif_alloc_env();
+    if (store->get(bucket, key, env, term) && engines[bucket]->put(key, term, stored)) {
+        if (exporter != NULL) {
+            exporter->put(bucket, key, get_env(key), stored);
+        }
+    }
+    enif_free_env(env);
+}
+
+// Needs the write lock unless resident() has just said otherwise.
 bool NeuralTable::find(unsigned long int key, ERL_NIF_TERM &ret) {
-    hash_table *bucket = &hash_buckets[GET_BUCKET(key)];
-    hash_table::iterator it = bucket->find(key);
-    if (bucket->end() == it) {
-        return false;
-    } else {
-        ret = it->second;
-        return true;
+    sample_key(key, true, false);
+    load(GET_BUCKET(key), key);
+    return engines[GET_BUCKET(key)]->find(key, ret);
+}
+
+// Copies the tuple stored under key into env. Needs the read lock and
+// resident(key).
+bool NeuralTable::read(unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM &ret) {
+    sample_key(key, true, false);
+    return engines[GET_BUCKET(key)]->read(key, env, ret);
+}
+
+// Returns false if finding key would have to fault, inflate or load it.
+bool NeuralTable::resident(unsigned long int key) {
+    int bucket = GET_BUCKET(key);
+    if (engines[bucket]->contains(key)) {
+        return engines[bucket]->resident(key);
     }
+    return loaded[bucket] || !store->contains(bucket, key);
 }
 
 bool NeuralTable::erase(unsigned long int key, ERL_NIF_TERM &val) {
-    hash_table *bucket = &hash_buckets[GET_BUCKET(key)];
-    hash_table::iterator it = bucket->find(key);
-    bool ret = false;
-    if (it != bucket->end()) {
-        ret = true;
-        val = it->second;
-        bucket->erase(it);
+    int bucket = GET_BUCKET(key);
+
+    sample_key(key, true, true);
+    load(bucket, key);
+    if (!engines[bucket]->erase(key, val)) {
+        return false;
     }
-    return ret;
+    if (store != NULL) {
+        store->erase(bucket, key);
+    }
+    if (exporter != NULL) {
+        exporter->erase(bucket, key);
+    }
+    return true;
 }
 
-void NeuralTable::add_batch_job(ErlNifPid pid, BatchFunction fun) {
+void NeuralTable::add_batch_job(ErlNifPid pid, BatchFunction fun, const char *name, const BatchArgs &args) {
     BatchJob job;
     job.pid = pid;
     job.fun = fun;
+    job.name = name;
+    job.args = args;
 
     enif_mutex_lock(batch_mutex);
     batch_jobs.push(job);
@@ -811,23 +496,19 @@ void NeuralTable::add_batch_job(ErlNifPid pid, BatchFunction fun) {
     enif_cond_signal(batch_cond);
 }
 
-void NeuralTable::batch_drain(ErlNifPid pid) {
+void NeuralTable::batch_drain(ErlNifPid pid, const BatchArgs &args) {
     ErlNifEnv *env = enif_alloc_env();
     ERL_NIF_TERM msg, value;
 
     value = enif_make_list(env, 0);
     for (int i = 0; i < BUCKET_COUNT; ++i) {
-        enif_rwlock_rwlock(locks[i]);
-
-        for (hash_table::iterator it = hash_buckets[i].begin(); it != hash_buckets[i].end(); ++it) {
-            value = enif_make_list_cell(env, enif_make_copy(env, it->second), value);
-        }
-        enif_clear_env(env_buckets[i]);
-        hash_buckets[i].clear();
-        garbage_cans[i] = 0;
-        reclaimable[i] = enif_make_list(env_buckets[i], 0);
+        EngineLeftovers *leftovers;
 
+        enif_rwlock_rwlock(locks[i]);
+        value = read_bucket(env, i, value);
+        leftovers = clear_bucket(i);
         enif_rwlock_rwunlock(locks[i]);
+        free_later(leftovers);
     }
 
     msg = enif_make_tuple2(env, enif_make_atom(env, "$neural_batch_response"), value);
@@ -837,16 +518,59 @@ void NeuralTable::batch_drain(ErlNifPid pid) {
     enif_free_env(env);
 }
 
-void NeuralTable::batch_dump(ErlNifPid pid) {
+/* ================================================================
+ * batch_load
+ * Loads every bucket of a reattached store into memory. Keys are
+ * loaded a chunk at a time so that a bucket is never locked for long,
+ * and lookups keep loading single keys on demand until their bucket
+ * is done. Once a bucket is loaded, misses no longer probe the store.
+ */
+void NeuralTable::batch_load(ErlNifPid pid, const BatchArgs &args) {
+    vector<unsigned long int> keys;
+    ErlNifEnv *env = enif_alloc_env();
+    ERL_NIF_TERM term, stored;
+    size_t n, end;
+
+    for (int i = 0; i < BUCKET_COUNT && running.load(memory_order_acquire); ++i) {
+        keys.clear();
+
+        enif_rwlock_rlock(locks[i]);
+        if (!loaded[i]) {
+            store->keys(i, keys);
+        }
+        enif_rwlock_runlock(locks[i]);
+
+        for (n = 0; n < keys.size(); n = end) {
+            end = n + LOAD_CHUNK < keys.size() ? n + LOAD_CHUNK : keys.size();
+
+            enif_rwlock_rwlock(locks[i]);
+            for (; n < end; ++n) {
+                if (!engines[i]->contains(keys[n]) && store->get(i, keys[n], env, term) && engines[i]->put(keys[n], term, stored)) {
+                    if (exporter != NULL) {
+                        exporter->put(i, keys[n], engines[i]->env(), stored);
+                    }
+                }
+            }
+            enif_rwlock_rwunlock(locks[i]);
+            enif_clear_env(env);
+        }
+
+        enif_rwlock_rwlock(locks[i]);
+        loaded[i] = true;
+        enif_rwlock_rwunlock(locks[i]);
+    }
+
+    enif_free_env(env);
+}
+
+void NeuralTable::batch_dump(ErlNifPid pid, const BatchArgs &args) {
     ErlNifEnv *env = enif_alloc_env();
     ERL_NIF_TERM msg, value;
 
     value = enif_make_list(env, 0);
     for (int i = 0; i < BUCKET_COUNT; ++i) {
         enif_rwlock_rlock(locks[i]);
-        for (hash_table::iterator it = hash_buckets[i].begin(); it != hash_buckets[i].end(); ++it) {
-            value = enif_make_list_cell(env, enif_make_copy(env, it->second), value);
-        }
+        value = read_bucket(env, i, value);
         enif_rwlock_runlock(locks[i]);
     }
 
@@ -858,42 +582,424 @@ void NeuralTable::batch_dump(ErlNifPid pid) {
 }
 
 void NeuralTable::reclaim(unsigned long int key, ERL_NIF_TERM term) {
-    int bucket = GET_BUCKET(key);
-    ErlNifEnv *env = get_env(key);
-    reclaimable[bucket] = enif_make_list_cell(env, term, reclaimable[bucket]);
+    engines[GET_BUCKET(key)]->discard(key, term);
 }
 
 void NeuralTable::gc() {
-    ErlNifEnv *fresh    = NULL,
-              *old      = NULL;
-    hash_table *bucket  = NULL;
-    hash_table::iterator it;
-    unsigned int gc_curr = 0;
-
-    for (; gc_curr < BUCKET_COUNT; ++gc_curr) {
-        bucket = &hash_buckets[gc_curr];
-        old = env_buckets[gc_curr];
-        fresh = enif_alloc_env();
-    
-        enif_rwlock_rwlock(locks[gc_curr]);
-        for  (it = bucket->begin(); it != bucket->end(); ++it) {
-            it->second = enif_make_copy(fresh, it->second);
+    ErlNifTime end, began, last;
+    atomic<unsigned long int> total(0);
+    double target, rate;
+
+    began = enif_monotonic_time(ERL_NIF_USEC);
+    gc_pool->run(BUCKET_COUNT, gc_parallelism.load(memory_order_relaxed), [&](int i) {
+        ErlNifTime micros;
+        unsigned long int garbage;
+
+        collect_bucket(i, micros, garbage);
+        total.fetch_add(garbage, memory_order_relaxed);
+    });
+    end = enif_monotonic_time(ERL_NIF_USEC);
+
+    // Adaptive tables collect as rarely as they can while garbage keeps
+    // coming in, but often enough that collecting at the last
+    // collection's cost stays within GC_ADAPTIVE_DUTY of the time.
+    gc_freed.store(total.load(memory_order_relaxed), memory_order_relaxed);
+    last = gc_last.exchange(end / 1000, memory_order_relaxed);
+    if (end / 1000 > last) {
+        rate = (double)total.load(memory_order_relaxed) / (end / 1000 - last);
+        target = rate * (end - began) / 1000 / GC_ADAPTIVE_DUTY;
+        target = (target + gc_adaptive_bytes.load(memory_order_relaxed)) / 2;
+        target = target < GC_MIN_THRESHOLD ? GC_MIN_THRESHOLD : target > GC_MAX_THRESHOLD ? GC_MAX_THRESHOLD : target;
+        gc_adaptive_bytes.store((unsigned long int)target, memory_order_relaxed);
+    }
+    garbage_seen.store(garbage_size(), memory_order_relaxed);
+}
+
+/* ================================================================
+ * collect_bucket
+ * Compacts one bucket under its write lock and records the run in
+ * the bucket's GC stats. Returns how long the bucket was locked and
+ * how much garbage it freed.
+ */
+void NeuralTable::collect_bucket(int bucket, ErlNifTime &micros, unsigned long int &garbage) {
+    ErlNifTime start;
+
+    enif_rwlock_rwlock(locks[bucket]);
+    NEURAL_PROBE1(gc__start, bucket);
+    start = enif_monotonic_time(ERL_NIF_USEC);
+    garbage = engines[bucket]->garbage();
+    engines[bucket]->compact();
+    // Garbage of tenured entries can outlast a minor compaction.
+    garbage -= engines[bucket]->garbage();
+    micros = enif_monotonic_time(ERL_NIF_USEC) - start;
+    NEURAL_PROBE3(gc__done, bucket, (unsigned long int)micros, garbage);
+    enif_rwlock_rwunlock(locks[bucket]);
+
+    gc_stats[bucket].runs.fetch_add(1, memory_order_relaxed);
+    gc_stats[bucket].micros.fetch_add(micros, memory_order_relaxed);
+    gc_stats[bucket].reclaimed.fetch_add(garbage, memory_order_relaxed);
+}
+
+/* ================================================================
+ * batch_compact
+ * Collects args.bucket, or every bucket, whatever the GC policy and
+ * even while GC is paused. Buckets holding less than args.min_garbage
+ * bytes of garbage are skipped. Replies with a
+ * {Bucket, Micros, BytesReclaimed} tuple per collected bucket.
+ */
+void NeuralTable::batch_compact(ErlNifPid pid, const BatchArgs &args) {
+    ErlNifEnv *env = enif_alloc_env();
+    ERL_NIF_TERM msg, value;
+    ErlNifTime micros[BUCKET_COUNT];
+    unsigned long int garbage[BUCKET_COUNT];
+    bool collected[BUCKET_COUNT];
+    int first = args.bucket < 0 ? 0 : args.bucket,
+        count = args.bucket < 0 ? BUCKET_COUNT : 1;
+
+    gc_pool->run(count, gc_parallelism.load(memory_order_relaxed), [&](int n) {
+        int i = first + n;
+
+        enif_rwlock_rlock(locks[i]);
+        garbage[i] = engines[i]->garbage();
+        enif_rwlock_runlock(locks[i]);
+
+        collected[i] = garbage[i] >= args.min_garbage;
+        if (collected[i]) {
+            collect_bucket(i, micros[i], garbage[i]);
+        }
+    });
+
+    value = enif_make_list(env, 0);
+    for (int i = first + count - 1; i >= first; --i) {
+        if (collected[i]) {
+            value = enif_make_list_cell(env, enif_make_tuple3(env,
+                        enif_make_int(env, i),
+                        enif_make_ulong(env, micros[i]),
+                        enif_make_ulong(env, garbage[i])), value);
         }
-    
-        garbage_cans[gc_curr] = 0;
-        env_buckets[gc_curr] = fresh;
-        reclaimable[gc_curr] = enif_make_list(fresh, 0);
-        enif_free_env(old);
-        enif_rwlock_rwunlock(locks[gc_curr]);
     }
+
+    msg = enif_make_tuple2(env, enif_make_atom(env, "$neural_batch_response"), value);
+
+    enif_send(NULL, &pid, env, msg);
+
+    enif_free_env(env);
+}
+
+/* ================================================================
+ * gc_due
+ * Whether the table's policy calls for a collection, given how much
+ * garbage and how much live data it holds.
+ */
+bool NeuralTable::gc_due(unsigned long int garbage, unsigned long int live) {
+    unsigned long int threshold;
+    ErlNifTime now = enif_monotonic_time(ERL_NIF_MSEC);
+
+    if (gc_paused.load(memory_order_relaxed)) {
+        return false;
+    }
+    // Past the soft limit writers are being held back; don't keep them
+    // waiting on the policy. Garbage a collection can't free stays past
+    // it though, so back off rather than collect in a tight loop.
+    if (gc_soft_limit.load(memory_order_relaxed) > 0 && garbage >= gc_soft_limit.load(memory_order_relaxed)) {
+        if (gc_freed.load(memory_order_relaxed) > 0) {
+            return now - gc_last.load(memory_order_relaxed) >= GC_SOFT_INTERVAL;
+        }
+        return now - gc_last.load(memory_order_relaxed) >= GC_SOFT_BACKOFF;
+    }
+    if (now - gc_last.load(memory_order_relaxed) < gc_interval.load(memory_order_relaxed)) {
+        return false;
+    }
+
+    switch (gc_mode.load(memory_order_relaxed)) {
+        case GC_RATIO:
+            threshold = live * gc_ratio.load(memory_order_relaxed);
+            break;
+        case GC_ADAPTIVE:
+            threshold = gc_adaptive_bytes.load(memory_order_relaxed);
+            break;
+        default:
+            threshold = gc_bytes.load(memory_order_relaxed);
+            break;
+    }
+    if (gc_mode.load(memory_order_relaxed) != GC_BYTES && threshold < GC_MIN_THRESHOLD) {
+        threshold = GC_MIN_THRESHOLD;
+    }
+
+    return garbage >= threshold;
+}
+
+GcPolicy NeuralTable::get_gc_policy() {
+    GcPolicy policy;
+
+    policy.mode = gc_mode.load(memory_order_relaxed);
+    policy.bytes = gc_bytes.load(memory_order_relaxed);
+    policy.ratio = gc_ratio.load(memory_order_relaxed);
+    policy.min_interval = gc_interval.load(memory_order_relaxed);
+    policy.parallelism = gc_parallelism.load(memory_order_relaxed);
+    policy.soft_limit = gc_soft_limit.load(memory_order_relaxed);
+    policy.hard_limit = gc_hard_limit.load(memory_order_relaxed);
+
+    return policy;
+}
+
+// Takes effect from the reclaimer's next pass.
+void NeuralTable::set_gc_policy(const GcPolicy &policy) {
+    gc_mode.store(policy.mode, memory_order_relaxed);
+    gc_bytes.store(policy.bytes, memory_order_relaxed);
+    gc_ratio.store(policy.ratio, memory_order_relaxed);
+    gc_interval.store(policy.min_interval, memory_order_relaxed);
+    gc_parallelism.store(policy.parallelism, memory_order_relaxed);
+    gc_soft_limit.store(policy.soft_limit, memory_order_relaxed);
+    gc_hard_limit.store(policy.hard_limit, memory_order_relaxed);
+}
+
+/* ================================================================
+ * admit
+ * Decides whether a write to key may go ahead, going by the garbage
+ * the table held when last measured. Past the soft limit the write
+ * uses up part of the caller's timeslice, more the closer the garbage
+ * is to the hard limit (or to twice the soft one), so writers yield
+ * to the collector sooner. Past the hard limit it is refused.
+ */
+bool NeuralTable::admit(ErlNifEnv *env, unsigned long int key) {
+    unsigned long int soft = gc_soft_limit.load(memory_order_relaxed),
+                      hard = gc_hard_limit.load(memory_order_relaxed),
+                      garbage, ceiling;
+    int percent;
+
+    if (soft == 0 && hard == 0) {
+        return true;
+    }
+
+    garbage = garbage_seen.load(memory_order_relaxed);
+    if (hard > 0 && garbage >= hard) {
+        stats[GET_BUCKET(key)].rejected.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+    if (soft > 0 && garbage >= soft) {
+        ceiling = hard > soft ? hard : soft * 2;
+        percent = garbage >= ceiling ? 100 : 1 + (garbage - soft) * 99 / (ceiling - soft);
+        enif_consume_timeslice(env, percent);
+        stats[GET_BUCKET(key)].throttled.fetch_add(1, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+unsigned long int NeuralTable::live_size() {
+    unsigned long int size = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        enif_rwlock_rlock(locks[i]);
+        size += engines[i]->live();
+        enif_rwlock_runlock(locks[i]);
+    }
+    return size;
 }
 
 unsigned long int NeuralTable::garbage_size() {
     unsigned long int size = 0;
     for (int i = 0; i < BUCKET_COUNT; ++i) {
         enif_rwlock_rlock(locks[i]);
-        size += garbage_cans[i];
+        size += engines[i]->garbage();
         enif_rwlock_runlock(locks[i]);
     }
     return size;
 }
+
+/* ================================================================
+ * read_bucket
+ * Copies every tuple in bucket into env, including those not yet
+ * loaded from the store, and prepends them to list. Safe under the
+ * read lock.
+ */
+ERL_NIF_TERM NeuralTable::read_bucket(ErlNifEnv *env, int bucket, ERL_NIF_TERM list) {
+    vector<unsigned long int> keys;
+    vector<unsigned long int>::iterator key;
+    ERL_NIF_TERM term;
+
+    engines[bucket]->iterate(env, [&](unsigned long int key, ERL_NIF_TERM tuple) {
+        list = enif_make_list_cell(env, tuple, list);
+    });
+
+    if (!loaded[bucket]) {
+        store->keys(bucket, keys);
+        for (key = keys.begin(); key != keys.end(); ++key) {
+            if (!engines[bucket]->contains(*key) && store->get(bucket, *key, env, term)) {
+                list = enif_make_list_cell(env, term, list);
+            }
+        }
+    }
+
+    return list;
+}
+
+/* ================================================================
+ * cold_sweep
+ * Lets each bucket's engine compress or spill its idle entries. Runs
+ * on the reclaimer thread.
+ */
+void NeuralTable::cold_sweep() {
+    unsigned int now = cold_clock.load(memory_order_relaxed);
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        enif_rwlock_rwlock(locks[i]);
+        engines[i]->sweep(now);
+        enif_rwlock_rwunlock(locks[i]);
+    }
+}
+
+/* ================================================================
+ * compact_store
+ * Rewrites the store without its dead records. The whole table is
+ * locked while this runs.
+ */
+void NeuralTable::compact_store() {
+    int n;
+
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        enif_rwlock_rwlock(locks[n]);
+    }
+
+    if (!store->compact()) {
+        printf("[neural_store] Can't compact store\r\n");
+    }
+
+    for (n = 0; n < BUCKET_COUNT; ++n) {
+        enif_rwlock_rwunlock(locks[n]);
+    }
+}
+
+/* ================================================================
+ * subscribe
+ * Has the reclaimer send pid a map of what changed in the table every
+ * interval milliseconds, replacing any earlier subscription of pid.
+ * An interval of 0 cancels the subscription.
+ */
+void NeuralTable::subscribe(ErlNifPid pid, unsigned int interval) {
+    vector<Subscriber>::iterator it;
+    Subscriber sub;
+
+    sub.pid = pid;
+    sub.interval = interval;
+    sub.due = enif_monotonic_time(ERL_NIF_MSEC) + interval;
+    count(sub.last);
+
+    enif_mutex_lock(subscriber_mutex);
+    for (it = subscribers.begin(); it != subscribers.end(); ++it) {
+        if (enif_compare_pids(&it->pid, &pid) == 0) {
+            subscribers.erase(it);
+            break;
+        }
+    }
+    if (interval > 0) {
+        subscribers.push_back(sub);
+    }
+    enif_mutex_unlock(subscriber_mutex);
+}
+
+void NeuralTable::count(TableCounters &ret) {
+    memset(&ret, 0, sizeof(ret));
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        ret.ops += stats[i].ops.load(memory_order_relaxed);
+        ret.hits += stats[i].hits.load(memory_order_relaxed);
+        ret.misses += stats[i].misses.load(memory_order_relaxed);
+        ret.lock_waits += stats[i].lock_waits.load(memory_order_relaxed);
+        ret.throttled += stats[i].throttled.load(memory_order_relaxed);
+        ret.rejected += stats[i].rejected.load(memory_order_relaxed);
+        ret.rescheduled += stats[i].rescheduled.load(memory_order_relaxed);
+        ret.gc_runs += gc_stats[i].runs.load(memory_order_relaxed);
+
+        enif_rwlock_rlock(locks[i]);
+        ret.garbage += engines[i]->garbage();
+        ret.entries += engines[i]->count();
+        enif_rwlock_runlock(locks[i]);
+    }
+}
+
+/* ================================================================
+ * push_telemetry
+ * Sends every subscriber that is due a
+ * {neural_telemetry, Table, #{...}} message. Counters are sent as the
+ * change since the last message, garbage and entries as they are now.
+ * Subscribers that have gone away are dropped.
+ */
+void NeuralTable::push_telemetry() {
+    ErlNifTime now = enif_monotonic_time(ERL_NIF_MSEC);
+    vector<Subscriber>::iterator it;
+    TableCounters cur;
+    ErlNifEnv *env;
+    ERL_NIF_TERM map, msg;
+    bool counted = false;
+
+    enif_mutex_lock(subscriber_mutex);
+    for (it = subscribers.begin(); it != subscribers.end();) {
+        if (now < it->due) {
+            ++it;
+            continue;
+        }
+        if (!counted) {
+            count(cur);
+            counted = true;
+        }
+
+        env = enif_alloc_env();
+        map = enif_make_new_map(env);
+        enif_make_map_put(env, map, enif_make_atom(env, "ops"), enif_make_ulong(env, cur.ops - it->last.ops), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "hits"), enif_make_ulong(env, cur.hits - it->last.hits), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "misses"), enif_make_ulong(env, cur.misses - it->last.misses), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "lock_waits"), enif_make_ulong(env, cur.lock_waits - it->last.lock_waits), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "throttled"), enif_make_ulong(env, cur.throttled - it->last.throttled), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "rejected"), enif_make_ulong(env, cur.rejected - it->last.rejected), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "rescheduled"), enif_make_ulong(env, cur.rescheduled - it->last.rescheduled), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "gc_runs"), enif_make_ulong(env, cur.gc_runs - it->last.gc_runs), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "garbage"), enif_make_ulong(env, cur.garbage), &map);
+        enif_make_map_put(env, map, enif_make_atom(env, "entries"), enif_make_ulong(env, cur.entries), &map);
+        msg = enif_make_tuple3(env, enif_make_atom(env, "neural_telemetry"), enif_make_atom(env, name.c_str()), map);
+
+        if (!enif_send(NULL, &it->pid, env, msg)) {
+            enif_free_env(env);
+            it = subscribers.erase(it);
+            continue;
+        }
+        enif_free_env(env);
+
+        it->last = cur;
+        it->due = now + it->interval;
+        ++it;
+    }
+    enif_mutex_unlock(subscriber_mutex);
+}
+
+/* ================================================================
+ * top_keys
+ * Fills ret with the n keys the trackers saw accessed most, busiest
+ * first. Access rates count only what each key is known to have had
+ * of its counter, not what it inherited, and are scaled back up by
+ * the sampling rate.
+ */
+void NeuralTable::top_keys(unsigned int n, vector<HotKeyRate> &ret) {
+    vector<HotKey> keys;
+    vector<HotKey>::iterator it;
+    HotKeyRate rate;
+    double scale;
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        keys.clear();
+        scale = 1000.0 * hot_sample / hot_keys[i]->top(keys);
+        for (it = keys.begin(); it != keys.end(); ++it) {
+            rate.key = it->key;
+            rate.bucket = i;
+            rate.accesses = (it->count - it->error) * scale;
+            rate.writes = it->writes * scale;
+            ret.push_back(rate);
+        }
+    }
+
+    sort(ret.begin(), ret.end(), [](const HotKeyRate &a, const HotKeyRate &b) {
+        return a.accesses > b.accesses;
+    });
+    if (ret.size() > n) {
+        ret.resize(n);
+    }
+}
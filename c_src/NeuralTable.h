@@ -2,55 +2,134 @@
 #define NEURALTABLE_H
 
 #include "erl_nif.h"
-#include "neural_utils.h"
+#include "NeuralEngine.h"
+#include "NeuralStore.h"
+#include "NeuralExport.h"
+#include "NeuralTraceRing.h"
+#include "NeuralHotKeys.h"
+#include "NeuralGcPool.h"
+#include "neural_trace.h"
 #include <string>
 #include <stdio.h>
 #include <string.h>
 #include <unordered_map>
 #include <queue>
+#include <vector>
+#include <algorithm>
 #include <atomic>
 #include <unistd.h>
+#include <time.h>
 
 #define BUCKET_COUNT 64
 #define BUCKET_MASK (BUCKET_COUNT - 1)
 #define GET_BUCKET(key) key & BUCKET_MASK
 #define GET_LOCK(key) key & BUCKET_MASK
-#define RECLAIM_THRESHOLD 1048576
+#define GC_MIN_THRESHOLD 65536
+#define GC_MAX_THRESHOLD (1UL << 30)
+#define GC_ADAPTIVE_DUTY 0.05
+// How long collections past the soft limit wait after the last one,
+// in milliseconds, and how long after one that freed nothing.
+#define GC_SOFT_INTERVAL 10
+#define GC_SOFT_BACKOFF  1000
+#define COLD_SWEEP_INTERVAL 20
+#define LOAD_CHUNK 1024
+#define LOCK_SPIN 64
 
 using namespace std;
 
 class NeuralTable;
 
-typedef unordered_map<string, NeuralTable*> table_set;
-typedef unordered_map<unsigned long int, ERL_NIF_TERM> hash_table;
-typedef void (NeuralTable::*BatchFunction)(ErlNifPid pid);
+typedef unordered_map<ERL_NIF_TERM, NeuralTable*> table_set;
+/* What a batch job works on, for jobs that take more than a pid.
+ * bucket is -1 for every bucket.
+ */
+struct BatchArgs {
+    BatchArgs() : bucket(-1), min_garbage(0) { }
 
+    int                 bucket;
+    unsigned long int   min_garbage;
+};
+
+typedef void (NeuralTable::*BatchFunction)(ErlNifPid pid, const BatchArgs &args);
+
+/* What the garbage collector has done to one bucket so far. micros
+ * is the time the bucket spent locked for collection.
+ */
+struct GcStats {
+    atomic<unsigned long int> runs;
+    atomic<unsigned long int> micros;
+    atomic<unsigned long int> reclaimed;
+};
+
+/* Traffic counters of one bucket, padded to a cache line so that
+ * buckets don't contend on them. throttled and rejected count writes
+ * slowed down or refused for the table's garbage limits, rescheduled
+ * ops moved to a dirty scheduler to wait for the lock.
+ */
+struct BucketStats {
+    atomic<unsigned long int> ops;
+    atomic<unsigned long int> hits;
+    atomic<unsigned long int> misses;
+    atomic<unsigned long int> lock_waits;
+    atomic<unsigned long int> throttled;
+    atomic<unsigned long int> rejected;
+    atomic<unsigned long int> rescheduled;
+    char pad[64 - 7 * sizeof(atomic<unsigned long int>)];
+};
+
+/* Totals across a table, as last sent to a telemetry subscriber. */
+struct TableCounters {
+    unsigned long int ops;
+    unsigned long int hits;
+    unsigned long int misses;
+    unsigned long int lock_waits;
+    unsigned long int throttled;
+    unsigned long int rejected;
+    unsigned long int rescheduled;
+    unsigned long int gc_runs;
+    unsigned long int garbage;
+    unsigned long int entries;
+};
+
+/* A hot key as reported to Erlang, with rates per second. */
+struct HotKeyRate {
+    unsigned long int key;
+    int bucket;
+    double accesses;
+    double writes;
+};
+
+struct Subscriber {
+    ErlNifPid       pid;
+    unsigned int    interval;
+    ErlNifTime      due;
+    TableCounters   last;
+};
+
+/* A named table of 64 buckets. Each bucket has its own lock and its
+ * own storage engine; the table keeps the persistent store, the
+ * shared memory export and the background threads in step with them.
+ * Translating Erlang terms to table calls is left to neural.cpp.
+ */
 class NeuralTable {
     public:
-        static ERL_NIF_TERM MakeTable(ErlNifEnv *env, ERL_NIF_TERM name, ERL_NIF_TERM keypos);
-        static ERL_NIF_TERM Insert(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM object);
-        static ERL_NIF_TERM InsertNew(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM object);
-        static ERL_NIF_TERM Delete(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key);
-        static ERL_NIF_TERM Empty(ErlNifEnv *env, ERL_NIF_TERM table);
-        static ERL_NIF_TERM Get(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key);
-        static ERL_NIF_TERM Increment(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops);
-        static ERL_NIF_TERM Shift(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops);
-        static ERL_NIF_TERM Unshift(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops);
-        static ERL_NIF_TERM Swap(ErlNifEnv *env, ERL_NIF_TERM table, ERL_NIF_TERM key, ERL_NIF_TERM ops);
-        static ERL_NIF_TERM Dump(ErlNifEnv *env, ERL_NIF_TERM table);
-        static ERL_NIF_TERM Drain(ErlNifEnv *env, ERL_NIF_TERM table);
-        static ERL_NIF_TERM GetKeyPosition(ErlNifEnv *env, ERL_NIF_TERM table);
-        static ERL_NIF_TERM GarbageCollect(ErlNifEnv *env, ERL_NIF_TERM table);
-        static ERL_NIF_TERM GarbageSize(ErlNifEnv *env, ERL_NIF_TERM table);
-        static NeuralTable* GetTable(ErlNifEnv *env, ERL_NIF_TERM name);
+        static bool MakeTable(ERL_NIF_TERM atom, TableOptions &opts);
+        static NeuralTable* GetTable(ERL_NIF_TERM name);
         static void* DoGarbageCollection(void *table);
         static void* DoBatchOperations(void *table);
         static void* DoReclamation(void *table);
         static void Initialize() {
-            table_mutex = enif_mutex_create("neural_table_maker");
+            ErlNifSysInfo info;
+
+            enif_system_info(&info, sizeof(info));
+            dirty_fallback = info.dirty_scheduler_support != 0;
+            table_lock = enif_rwlock_create("neural_tables");
+            table_maker = enif_mutex_create("neural_table_maker");
+            gc_pool = new NeuralGcPool();
         }
         static void Shutdown() {
             running = false;
+            enif_rwlock_rwlock(table_lock);
             table_set::iterator it(tables.begin());
 
             while (it != tables.end()) {
@@ -59,46 +138,167 @@ class NeuralTable {
                 it = tables.begin();
             }
 
-            enif_mutex_destroy(table_mutex);
+            enif_rwlock_rwunlock(table_lock);
+            enif_rwlock_destroy(table_lock);
+            enif_mutex_destroy(table_maker);
+            delete gc_pool;
+        }
+
+        // The lock is tried first so that waits can be counted.
+        void rlock(unsigned long int key) {
+            int bucket = GET_LOCK(key);
+            if (enif_rwlock_tryrlock(locks[bucket]) != 0) {
+                NEURAL_PROBE2(lock__contended, bucket, 0);
+                stats[bucket].lock_waits.fetch_add(1, memory_order_relaxed);
+                if (NeuralTraceScope::Timing()) {
+                    ErlNifTime start = enif_monotonic_time(ERL_NIF_NSEC);
+                    enif_rwlock_rlock(locks[bucket]);
+                    NeuralTraceScope::AddLockWait(enif_monotonic_time(ERL_NIF_NSEC) - start);
+                } else {
+                    enif_rwlock_rlock(locks[bucket]);
+                }
+            }
+            NEURAL_PROBE2(lock__acquire, bucket, 0);
+        }
+        void runlock(unsigned long int key) {
+            enif_rwlock_runlock(locks[GET_LOCK(key)]);
+            NEURAL_PROBE2(lock__release, (int)(GET_LOCK(key)), 0);
+        }
+        void rwlock(unsigned long int key) {
+            int bucket = GET_LOCK(key);
+            if (enif_rwlock_tryrwlock(locks[bucket]) != 0) {
+                NEURAL_PROBE2(lock__contended, bucket, 1);
+                stats[bucket].lock_waits.fetch_add(1, memory_order_relaxed);
+                if (NeuralTraceScope::Timing()) {
+                    ErlNifTime start = enif_monotonic_time(ERL_NIF_NSEC);
+                    enif_rwlock_rwlock(locks[bucket]);
+                    NeuralTraceScope::AddLockWait(enif_monotonic_time(ERL_NIF_NSEC) - start);
+                } else {
+                    enif_rwlock_rwlock(locks[bucket]);
+                }
+            }
+            NEURAL_PROBE2(lock__acquire, bucket, 1);
+        }
+        void rwunlock(unsigned long int key) {
+            enif_rwlock_rwunlock(locks[GET_LOCK(key)]);
+            NEURAL_PROBE2(lock__release, (int)(GET_LOCK(key)), 1);
+        }
+
+        // Like rlock() and rwlock(), except that on a normal scheduler
+        // they give up after LOCK_SPIN tries rather than block it, and
+        // return false. The caller then reschedules itself on a dirty
+        // scheduler, where these block like the others.
+        bool try_rlock(unsigned long int key) {
+            return try_lock(key, false);
+        }
+        bool try_rwlock(unsigned long int key) {
+            return try_lock(key, true);
         }
 
-        void rlock(unsigned long int key) { enif_rwlock_rlock(locks[GET_LOCK(key)]); }
-        void runlock(unsigned long int key) { enif_rwlock_runlock(locks[GET_LOCK(key)]); }
-        void rwlock(unsigned long int key) { enif_rwlock_rwlock(locks[GET_LOCK(key)]); }
-        void rwunlock(unsigned long int key) { enif_rwlock_rwunlock(locks[GET_LOCK(key)]); }
+        // Counts a keyed op, and whether it found its key.
+        void count_op(unsigned long int key, bool hit) {
+            BucketStats &bucket = stats[GET_BUCKET(key)];
+            bucket.ops.fetch_add(1, memory_order_relaxed);
+            (hit ? bucket.hits : bucket.misses).fetch_add(1, memory_order_relaxed);
+        }
 
+        // Feeds a sample of accesses and writes to the bucket's hot
+        // key tracker. Writes made after a find() aren't accesses of
+        // their own.
+        void sample_key(unsigned long int key, bool access, bool write) {
+            if (hot_sample > 0 && sample_one_in(hot_sample)) {
+                if (access) {
+                    hot_keys[GET_BUCKET(key)]->touch(key, write);
+                } else {
+                    hot_keys[GET_BUCKET(key)]->wrote(key);
+                }
+            }
+        }
+
+        bool admit(ErlNifEnv *env, unsigned long int key);
         ErlNifEnv *get_env(unsigned long int key);
         bool erase(unsigned long int key, ERL_NIF_TERM &ret);
         bool find(unsigned long int key, ERL_NIF_TERM &ret);
-        void put(unsigned long int key, ERL_NIF_TERM tuple);
-        void batch_dump(ErlNifPid pid);
-        void batch_drain(ErlNifPid pid);
-        void start_gc();
-        void stop_gc();
-        void start_batch();
-        void stop_batch();
-        void gc();
+        bool read(unsigned long int key, ErlNifEnv *env, ERL_NIF_TERM &ret);
+        bool resident(unsigned long int key);
+        // Both return false, storing nothing, if the engine or the
+        // store can't take the tuple.
+        bool put(unsigned long int key, ERL_NIF_TERM tuple);
+        bool put(ErlNifEnv *env, unsigned long int key, StagedTuple &staged);
+        // Does the copying for a put() of tuple, a term of env, ahead
+        // of taking the lock. Returns false if the engine can't store
+        // tuple, in which case it mustn't be put.
+        bool stage(ErlNifEnv *env, unsigned long int key, ERL_NIF_TERM tuple, StagedTuple &ret) {
+            return engines[GET_BUCKET(key)]->stage(env, tuple, ret);
+        }
         void reclaim(unsigned long int key, ERL_NIF_TERM reclaim);
+        void clear();
+        bool checkpoint();
+        bool persistent() { return store != NULL; }
+        unsigned int get_key_pos() { return key_pos; }
+        void collect() { enif_cond_signal(gc_cond); }
         unsigned long int garbage_size();
-        void add_batch_job(ErlNifPid pid, BatchFunction fun);
+        const GcStats& get_gc_stats(int bucket) { return gc_stats[bucket]; }
+        GcPolicy get_gc_policy();
+        void set_gc_policy(const GcPolicy &policy);
+        void subscribe(ErlNifPid pid, unsigned int interval);
+        // NULL unless the table was made with tracing.
+        NeuralTraceRing* get_tracer() { return tracer; }
+        bool tracks_hot_keys() { return hot_sample > 0; }
+        void top_keys(unsigned int n, vector<HotKeyRate> &ret);
+        void gc_pause() { gc_paused.store(true, memory_order_relaxed); }
+        void gc_resume() {
+            gc_paused.store(false, memory_order_relaxed);
+            enif_cond_signal(gc_cond);
+        }
+        void batch_dump(ErlNifPid pid, const BatchArgs &args);
+        void batch_drain(ErlNifPid pid, const BatchArgs &args);
+        void batch_load(ErlNifPid pid, const BatchArgs &args);
+        void batch_compact(ErlNifPid pid, const BatchArgs &args);
+        void add_batch_job(ErlNifPid pid, BatchFunction fun, const char *name, const BatchArgs &args = BatchArgs());
 
     protected:
         static table_set tables;
         static atomic<bool> running;
-        static ErlNifMutex *table_mutex;
+        // Whether ops can move to dirty schedulers to wait for a lock.
+        static bool dirty_fallback;
+        // Guards tables; every NIF call looks its table up under the read lock.
+        static ErlNifRWLock *table_lock;
+        // Serializes MakeTable, which opens files without table_lock.
+        static ErlNifMutex *table_maker;
+        static NeuralGcPool *gc_pool;
 
         struct BatchJob {
             ErlNifPid pid;
             BatchFunction fun;
+            const char *name;
+            BatchArgs args;
         };
 
-        NeuralTable(unsigned int kp);
+        NeuralTable(TableOptions &opts);
         ~NeuralTable();
 
-        unsigned int    garbage_cans[BUCKET_COUNT];
-        hash_table      hash_buckets[BUCKET_COUNT];
-        ErlNifEnv       *env_buckets[BUCKET_COUNT];
-        ERL_NIF_TERM    reclaimable[BUCKET_COUNT];
+        bool try_lock(unsigned long int key, bool write);
+        void start_gc();
+        void stop_gc();
+        void start_batch();
+        void stop_batch();
+        void gc();
+        void collect_bucket(int bucket, ErlNifTime &micros, unsigned long int &garbage);
+        bool gc_due(unsigned long int garbage, unsigned long int live);
+        unsigned long int live_size();
+        void cold_sweep();
+        void load(int bucket, unsigned long int key);
+        EngineLeftovers* clear_bucket(int bucket);
+        static void free_later(EngineLeftovers *leftovers) {
+            gc_pool->post([leftovers]() { delete leftovers; });
+        }
+        ERL_NIF_TERM read_bucket(ErlNifEnv *env, int bucket, ERL_NIF_TERM list);
+        void compact_store();
+        void count(TableCounters &ret);
+        void push_telemetry();
+
+        NeuralEngine    *engines[BUCKET_COUNT];
         ErlNifRWLock    *locks[BUCKET_COUNT];
         ErlNifCond      *gc_cond;
         ErlNifMutex     *gc_mutex;
@@ -108,8 +308,41 @@ class NeuralTable {
         ErlNifMutex     *batch_mutex;
         queue<BatchJob> batch_jobs;
         ErlNifTid       batch_tid;
+        NeuralStore     *store;
+        bool            loaded[BUCKET_COUNT];
+        NeuralExport    *exporter;
+        GcStats         gc_stats[BUCKET_COUNT];
+        atomic<int>     gc_mode;
+        atomic<unsigned long int> gc_bytes;
+        atomic<double>  gc_ratio;
+        atomic<unsigned int> gc_interval;
+        atomic<unsigned int> gc_parallelism;
+        atomic<unsigned long int> gc_soft_limit;
+        atomic<unsigned long int> gc_hard_limit;
+        // The table's garbage as of the reclaimer's last pass or the
+        // last collection, for admit() to check without locking.
+        atomic<unsigned long int> garbage_seen;
+        // Where the adaptive policy has settled, and when the last
+        // collection finished, in monotonic milliseconds.
+        atomic<unsigned long int> gc_adaptive_bytes;
+        atomic<ErlNifTime> gc_last;
+        // What the last collection freed.
+        atomic<unsigned long int> gc_freed;
+        // Stops the policy from starting collections; compact jobs
+        // still run.
+        atomic<bool>    gc_paused;
+        BucketStats     stats[BUCKET_COUNT];
+        ErlNifMutex     *subscriber_mutex;
+        vector<Subscriber> subscribers;
+        NeuralTraceRing *tracer;
+        NeuralHotKeys   *hot_keys[BUCKET_COUNT];
+        unsigned int    hot_sample;
 
+        string name;
         unsigned int key_pos;
+        // Monotonic seconds as of the reclaimer's last pass; entries
+        // are stamped with it when touched.
+        atomic<unsigned int> cold_clock;
 };
 
 #endif
@@ -0,0 +1,88 @@
+#include "NeuralTraceRing.h"
+
+thread_local NeuralTraceScope *NeuralTraceScope::current = NULL;
+
+NeuralTraceRing::NeuralTraceRing(unsigned int size, unsigned int rate, unsigned long int slow_ns)
+        : slots(size > 0 ? size : TRACE_DEFAULT_SIZE), sample_rate(rate), slow(slow_ns) {
+    head.store(0, memory_order_relaxed);
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[i].seq.store(0, memory_order_relaxed);
+    }
+}
+
+/* ================================================================
+ * record
+ * Claims the next slot and fills it in. Should the whole ring wrap
+ * while one writer fills its slot, the slot can end up mixing two
+ * records; that takes a ring far too small for its load.
+ */
+void NeuralTraceRing::record(const char *op, unsigned long int key, unsigned long int lock_wait, unsigned long int duration, ErlNifTime start) {
+    unsigned long int ticket = head.fetch_add(1, memory_order_relaxed);
+    Slot &slot = slots[ticket % slots.size()];
+
+    slot.seq.store(ticket * 2 + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.op.store(op, memory_order_relaxed);
+    slot.key.store(key, memory_order_relaxed);
+    slot.lock_wait.store(lock_wait, memory_order_relaxed);
+    slot.duration.store(duration, memory_order_relaxed);
+    slot.start.store(start, memory_order_relaxed);
+    slot.seq.store(ticket * 2 + 2, memory_order_release);
+}
+
+/* ================================================================
+ * snapshot
+ * Appends the records in the ring to ret, oldest first, leaving
+ * them in place.
+ */
+void NeuralTraceRing::snapshot(vector<TraceRecord> &ret) {
+    unsigned long int end = head.load(memory_order_acquire);
+    unsigned long int begin = end > slots.size() ? end - slots.size() : 0;
+    TraceRecord rec;
+
+    for (unsigned long int ticket = begin; ticket < end; ++ticket) {
+        Slot &slot = slots[ticket % slots.size()];
+
+        if (slot.seq.load(memory_order_acquire) != ticket * 2 + 2) {
+            continue;
+        }
+        rec.op = slot.op.load(memory_order_relaxed);
+        rec.key = slot.key.load(memory_order_relaxed);
+        rec.lock_wait = slot.lock_wait.load(memory_order_relaxed);
+        rec.duration = slot.duration.load(memory_order_relaxed);
+        rec.start = slot.start.load(memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.seq.load(memory_order_relaxed) != ticket * 2 + 2) {
+            continue;
+        }
+        ret.push_back(rec);
+    }
+}
+
+NeuralTraceScope::NeuralTraceScope(NeuralTraceRing *r, const char *op, unsigned long int key)
+        : ring(r), outer(NULL), op(op), key(key), lock_wait(0), start(0), sampled(false) {
+    if (ring == NULL) {
+        return;
+    }
+    sampled = ring->sample();
+    if (!sampled && !ring->timed()) {
+        ring = NULL;
+        return;
+    }
+    outer = current;
+    current = this;
+    start = enif_monotonic_time(ERL_NIF_NSEC);
+}
+
+NeuralTraceScope::~NeuralTraceScope() {
+    unsigned long int duration;
+
+    if (ring == NULL) {
+        return;
+    }
+    duration = enif_monotonic_time(ERL_NIF_NSEC) - start;
+    current = outer;
+    if (sampled || ring->slow_op(duration)) {
+        ring->record(op, key, lock_wait, duration, start);
+    }
+}
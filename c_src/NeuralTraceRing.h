@@ -0,0 +1,93 @@
+#ifndef NEURALTRACERING_H
+#define NEURALTRACERING_H
+
+#include "erl_nif.h"
+#include "neural_utils.h"
+#include <atomic>
+#include <vector>
+
+#define TRACE_DEFAULT_SIZE 4096
+
+using namespace std;
+
+/* One op as recorded in the ring. op points at a string literal, and
+ * times are monotonic nanoseconds.
+ */
+struct TraceRecord {
+    const char          *op;
+    unsigned long int   key;
+    unsigned long int   lock_wait;
+    unsigned long int   duration;
+    ErlNifTime          start;
+};
+
+/* A fixed size ring of recent ops, written without locks by every
+ * scheduler thread running ops on the table. Each slot carries a
+ * sequence number that is odd while the slot is being written, so
+ * snapshot() skips slots that change under it. Once the ring wraps,
+ * new records overwrite the oldest.
+ *
+ * An op is recorded when it is sampled, 1 in sample_rate ops, or when
+ * it takes slow nanoseconds or more. Either can be 0 to turn it off.
+ */
+class NeuralTraceRing {
+    public:
+        NeuralTraceRing(unsigned int size, unsigned int sample_rate, unsigned long int slow);
+
+        bool sample() { return sample_one_in(sample_rate); }
+        bool timed() { return slow > 0; }
+        bool slow_op(unsigned long int duration) { return slow > 0 && duration >= slow; }
+        void record(const char *op, unsigned long int key, unsigned long int lock_wait, unsigned long int duration, ErlNifTime start);
+        void snapshot(vector<TraceRecord> &ret);
+
+    protected:
+        struct Slot {
+            atomic<unsigned long int>   seq;
+            atomic<const char*>         op;
+            atomic<unsigned long int>   key;
+            atomic<unsigned long int>   lock_wait;
+            atomic<unsigned long int>   duration;
+            atomic<ErlNifTime>          start;
+        };
+
+        vector<Slot> slots;
+        atomic<unsigned long int> head;
+        unsigned int sample_rate;
+        unsigned long int slow;
+};
+
+/* Times the op it is declared in, from there to the end of the
+ * enclosing scope, and records it in ring if the ring wants it. Does
+ * nothing when ring is NULL or the op is neither sampled nor timed.
+ * Bucket locks report their waits to the innermost timed scope of the
+ * calling thread through AddLockWait().
+ */
+class NeuralTraceScope {
+    public:
+        NeuralTraceScope(NeuralTraceRing *ring, const char *op, unsigned long int key);
+        ~NeuralTraceScope();
+
+        // Drops the op without recording it.
+        void cancel() {
+            if (ring != NULL) {
+                current = outer;
+                ring = NULL;
+            }
+        }
+
+        static bool Timing() { return current != NULL; }
+        static void AddLockWait(ErlNifTime wait) { current->lock_wait += wait; }
+
+    protected:
+        static thread_local NeuralTraceScope *current;
+
+        NeuralTraceRing *ring;
+        NeuralTraceScope *outer;
+        const char *op;
+        unsigned long int key;
+        unsigned long int lock_wait;
+        ErlNifTime start;
+        bool sampled;
+};
+
+#endif
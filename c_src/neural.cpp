@@ -1,6 +1,8 @@
 #include "erl_nif.h"
 #include "NeuralTable.h"
+#include "NeuralScratch.h"
 #include <stdio.h>
+#include <new>
 
 // Prototypes
 static ERL_NIF_TERM neural_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
@@ -18,10 +20,20 @@ static ERL_NIF_TERM neural_empty(ErlNifEnv *env, int argc, const ERL_NIF_TERM ar
 static ERL_NIF_TERM neural_drain(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
 static ERL_NIF_TERM neural_dump(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
 static ERL_NIF_TERM neural_key_pos(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_checkpoint(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_gc_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_telemetry(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_trace_dump(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_hot_keys(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_set_opts(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_gc_pause(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_gc_resume(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_compact(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+static ERL_NIF_TERM neural_alloc_count(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
 
 static ErlNifFunc nif_funcs[] =
 {
-    {"make_table", 2, neural_new},
+    {"make_table", 3, neural_new},
     {"do_fetch", 2, neural_get},
     {"do_delete", 2, neural_delete},
     {"do_dump", 1, neural_dump},
@@ -35,84 +47,1207 @@ static ErlNifFunc nif_funcs[] =
     {"do_swap", 3, neural_swap},
     {"garbage", 1, neural_garbage},
     {"garbage_size", 1, neural_garbage_size},
-    {"key_pos", 1, neural_key_pos}
+    {"key_pos", 1, neural_key_pos},
+    {"checkpoint", 1, neural_checkpoint},
+    {"gc_stats", 1, neural_gc_stats},
+    {"telemetry", 3, neural_telemetry},
+    {"trace_dump", 1, neural_trace_dump},
+    {"hot_keys", 2, neural_hot_keys},
+    {"do_set_opts", 2, neural_set_opts},
+    {"gc_pause", 1, neural_gc_pause},
+    {"gc_resume", 1, neural_gc_resume},
+    {"do_compact", 3, neural_compact},
+    {"alloc_count", 0, neural_alloc_count}
 };
 
+/* ================================================================
+ * get_table
+ * Retrieves a handle to the table named by the atom name, or NULL if
+ * there is no such table.
+ */
+static NeuralTable* get_table(ErlNifEnv *env, ERL_NIF_TERM name) {
+    return NeuralTable::GetTable(name);
+}
+
+typedef ERL_NIF_TERM (*NifFunction)(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]);
+
+/* ================================================================
+ * reschedule
+ * Reruns an op from the top on a dirty I/O scheduler, where it can
+ * wait for its bucket lock without holding up a normal scheduler.
+ * The first attempt leaves no trace record, and the rerun skips the
+ * admission the first attempt went through.
+ */
+static ERL_NIF_TERM reschedule(ErlNifEnv *env, const char *name, NifFunction fun, int argc, const ERL_NIF_TERM argv[], NeuralTraceScope &trace) {
+    trace.cancel();
+    return enif_schedule_nif(env, name, ERL_NIF_DIRTY_JOB_IO_BOUND, fun, argc, argv);
+}
+
+static ErlNifResourceType *staged_type = NULL;
+
+static void destroy_staged(ErlNifEnv *env, void *obj) {
+    ((StagedTuple*)obj)->~StagedTuple();
+}
+
+/* ================================================================
+ * reschedule_staged
+ * Like reschedule, for inserts that have staged their tuple already.
+ * The staged copy is handed to the rerun as a fourth argument, so it
+ * neither copies the tuple again nor goes through admission twice.
+ */
+static ERL_NIF_TERM reschedule_staged(ErlNifEnv *env, const char *name, NifFunction fun, const ERL_NIF_TERM argv[], StagedTuple &staged, NeuralTraceScope &trace) {
+    StagedTuple *kept = new (enif_alloc_resource(staged_type, sizeof(StagedTuple))) StagedTuple();
+    ERL_NIF_TERM args[4];
+
+    kept->take(staged);
+    args[0] = argv[0];
+    args[1] = argv[1];
+    args[2] = argv[2];
+    args[3] = enif_make_resource(env, kept);
+    enif_release_resource(kept);
+
+    return reschedule(env, name, fun, 4, args, trace);
+}
+
+/* ================================================================
+ * get_staged
+ * Returns what reschedule_staged handed to this rerun of an insert,
+ * or NULL on the first attempt.
+ */
+static StagedTuple* get_staged(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    void *kept;
+
+    if (argc < 4 || !enif_get_resource(env, argv[3], staged_type, &kept)) {
+        return NULL;
+    }
+    return (StagedTuple*)kept;
+}
+
+// Whether this is the dirty rerun of an op that reschedule sent off.
+// The first attempt has been through admission already.
+static bool is_rerun() {
+    return enif_thread_type() != ERL_NIF_THR_NORMAL_SCHEDULER;
+}
+
+// What writes refused by admission control return.
+static ERL_NIF_TERM make_overloaded(ErlNifEnv *env) {
+    return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "overloaded"));
+}
+
+// What writes of tuples the table's engine can't store return.
+static ERL_NIF_TERM make_unstorable(ErlNifEnv *env) {
+    return enif_make_tuple2(env, enif_make_atom(env, "error"), enif_make_atom(env, "unstorable"));
+}
+
+static bool is_gc_option(ErlNifEnv *env, ERL_NIF_TERM name) {
+    return enif_is_identical(name, enif_make_atom(env, "gc"))
+        || enif_is_identical(name, enif_make_atom(env, "gc_interval"))
+        || enif_is_identical(name, enif_make_atom(env, "gc_parallelism"))
+        || enif_is_identical(name, enif_make_atom(env, "garbage_soft_limit"))
+        || enif_is_identical(name, enif_make_atom(env, "garbage_hard_limit"));
+}
+
+/* ================================================================
+ * get_gc_option
+ * Applies a {gc, Policy}, {gc_interval, Ms}, {gc_parallelism, N},
+ * {garbage_soft_limit, Bytes} or {garbage_hard_limit, Bytes} option
+ * to policy.
+ * Returns false if the value doesn't fit the option.
+ */
+static bool get_gc_option(ErlNifEnv *env, const ERL_NIF_TERM *opt_tpl, GcPolicy &policy) {
+    int arity = 0;
+    const ERL_NIF_TERM *mode_tpl;
+
+    if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "gc_interval"))) {
+        return enif_get_uint(env, opt_tpl[1], &policy.min_interval);
+    }
+    if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "gc_parallelism"))) {
+        return enif_get_uint(env, opt_tpl[1], &policy.parallelism) && policy.parallelism > 0;
+    }
+    if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "garbage_soft_limit"))) {
+        return enif_get_ulong(env, opt_tpl[1], &policy.soft_limit);
+    }
+    if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "garbage_hard_limit"))) {
+        return enif_get_ulong(env, opt_tpl[1], &policy.hard_limit);
+    }
+
+    if (enif_is_identical(opt_tpl[1], enif_make_atom(env, "adaptive"))) {
+        policy.mode = GC_ADAPTIVE;
+        return true;
+    }
+    if (!enif_get_tuple(env, opt_tpl[1], &arity, &mode_tpl) || arity != 2) {
+        return false;
+    }
+    if (enif_is_identical(mode_tpl[0], enif_make_atom(env, "bytes")) && enif_get_ulong(env, mode_tpl[1], &policy.bytes)) {
+        policy.mode = GC_BYTES;
+        return true;
+    }
+    if (enif_is_identical(mode_tpl[0], enif_make_atom(env, "ratio")) && enif_get_double(env, mode_tpl[1], &policy.ratio)) {
+        policy.mode = GC_RATIO;
+        return true;
+    }
+    return false;
+}
+
 static ERL_NIF_TERM neural_key_pos(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
     // This function is directly exposed, so no strict guards or patterns protecting us.
     if (argc != 1 || !enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::GetKeyPosition(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    return enif_make_uint(env, tb->get_key_pos());
 }
 
+/* ================================================================
+ * neural_new
+ * Allocates a new table, assuming a unique atom identifier. Options
+ * arrive as {Name, Value} pairs already validated by neural:new/2.
+ */
 static ERL_NIF_TERM neural_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::MakeTable(env, argv[0], argv[1]);
+    char name[256];
+    char path[4096];
+    int arity = 0;
+    const ERL_NIF_TERM *opt_tpl;
+    ERL_NIF_TERM opt, it;
+    TableOptions opts;
+
+    if (!enif_get_atom(env, argv[0], name, sizeof(name), ERL_NIF_LATIN1) || !enif_get_uint(env, argv[1], &opts.key_pos)) {
+        return enif_make_badarg(env);
+    }
+    opts.name = name;
+
+    it = argv[2];
+    while (enif_get_list_cell(env, it, &opt, &it)) {
+        if (!enif_get_tuple(env, opt, &arity, &opt_tpl) || arity != 2) {
+            return enif_make_badarg(env);
+        }
+
+        if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "engine"))) {
+            if (enif_is_identical(opt_tpl[1], enif_make_atom(env, "serialized"))) {
+                opts.engine = ENGINE_SERIALIZED;
+            } else if (enif_is_identical(opt_tpl[1], enif_make_atom(env, "env"))) {
+                opts.engine = ENGINE_ENV;
+            } else {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "tier"))) {
+            if (enif_get_string(env, opt_tpl[1], path, sizeof(path), ERL_NIF_LATIN1) <= 0) {
+                return enif_make_badarg(env);
+            }
+            opts.tier_path = path;
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "tier_idle"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.tier_idle)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "compress"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.compress_size)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "compress_idle"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.compress_idle)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "persist"))) {
+            if (enif_get_string(env, opt_tpl[1], path, sizeof(path), ERL_NIF_LATIN1) <= 0) {
+                return enif_make_badarg(env);
+            }
+            opts.persist_path = path;
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "export"))) {
+            if (enif_get_string(env, opt_tpl[1], path, sizeof(path), ERL_NIF_LATIN1) <= 0) {
+                return enif_make_badarg(env);
+            }
+            opts.export_name = path;
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "export_slots"))) {
+            if (!enif_get_ulong(env, opt_tpl[1], &opts.export_slots)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "trace_sample"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.trace_sample)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "trace_slow"))) {
+            if (!enif_get_ulong(env, opt_tpl[1], &opts.trace_slow)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "trace_size"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.trace_size)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "hot_keys"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.hot_sample)) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "tenure"))) {
+            if (!enif_get_uint(env, opt_tpl[1], &opts.tenure_age) || opts.tenure_age > 255) {
+                return enif_make_badarg(env);
+            }
+        } else if (enif_is_identical(opt_tpl[0], enif_make_atom(env, "large_object"))) {
+            if (!enif_get_ulong(env, opt_tpl[1], &opts.large_size)) {
+                return enif_make_badarg(env);
+            }
+        } else if (is_gc_option(env, opt_tpl[0])) {
+            if (!get_gc_option(env, opt_tpl, opts.gc)) {
+                return enif_make_badarg(env);
+            }
+        }
+    }
+
+    if (!NeuralTable::MakeTable(argv[0], opts)) {
+        return enif_make_badarg(env);
+    }
+    return enif_make_atom(env, "ok");
 }
 
+/* ================================================================
+ * neural_put
+ * Inserts a tuple into the table with key. 
+ */
 static ERL_NIF_TERM neural_put(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::Insert(env, argv[0], argv[1], argv[2]);
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old;
+    unsigned long int entry_key = 0;
+    bool found;
+    StagedTuple fresh, *staged;
+
+    // Grab table or bail.
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { 
+        return enif_make_badarg(env); 
+    }
+
+    // Get key value.
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("insert", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "insert", entry_key);
+
+    // Copy what can be copied before anyone has to wait for it. A
+    // rerun was admitted and staged on its first attempt.
+    staged = get_staged(env, argc, argv);
+    if (staged == NULL) {
+        if (!tb->admit(env, entry_key)) {
+            return make_overloaded(env);
+        }
+        staged = &fresh;
+        if (!tb->stage(env, entry_key, argv[2], *staged)) {
+            return make_unstorable(env);
+        }
+    }
+
+    // Lock the key.
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule_staged(env, "insert", neural_put, argv, *staged, trace);
+    }
+
+    // Attempt to lookup the value. If nonempty, return a copy
+    // of the old value and, once it's replaced, increment the
+    // discarded term counter
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        ret = enif_make_tuple2(env, enif_make_atom(env, "ok"), enif_make_copy(env, old));
+    } else {
+        ret = enif_make_atom(env, "ok");
+    }
+    
+    // Write that shit out
+    if (!tb->put(env, entry_key, *staged)) {
+        ret = make_unstorable(env);
+    } else if (found) {
+        tb->reclaim(entry_key, old);
+    }
+
+    // Oh, and unlock the key if you would.
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
+/* ================================================================
+ * neural_put_new
+ * Inserts a tuple into the table with key, assuming there is not
+ * a value with key already. Returns true if there was no value
+ * for key, or false if there was.
+ */
 static ERL_NIF_TERM neural_put_new(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::InsertNew(env, argv[0], argv[1], argv[2]);
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old;
+    unsigned long int entry_key = 0;
+    bool found;
+    StagedTuple fresh, *staged;
+
+    // Get the table or bail
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) {
+        return enif_make_badarg(env);
+    }
+
+    // Get the key value
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("insert_new", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "insert_new", entry_key);
+
+    // Staged in vain if the key turns out to exist, but then the
+    // lock isn't held for long either. A rerun was admitted and
+    // staged on its first attempt.
+    staged = get_staged(env, argc, argv);
+    if (staged == NULL) {
+        if (!tb->admit(env, entry_key)) {
+            return make_overloaded(env);
+        }
+        staged = &fresh;
+        if (!tb->stage(env, entry_key, argv[2], *staged)) {
+            return make_unstorable(env);
+        }
+    }
+
+    // Get write lock for the key
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule_staged(env, "insert_new", neural_put_new, argv, *staged, trace);
+    }
+
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        // Key was found. Return false and do not insert
+        ret = enif_make_atom(env, "false");
+    } else {
+        // Key was not found. Return true and insert
+        if (tb->put(env, entry_key, *staged)) {
+            ret = enif_make_atom(env, "true");
+        } else {
+            ret = make_unstorable(env);
+        }
+    }
+
+    // Release write lock for the key
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
+/* ================================================================
+ * neural_increment
+ * Processes a list of update operations. Each operation specifies
+ * a position in the stored tuple to update and an integer to add
+ * to it.
+ */
 static ERL_NIF_TERM neural_increment(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old;
+    ERL_NIF_TERM it;
+    unsigned long int entry_key = 0;
+    bool found;
+
     if (!enif_is_atom(env, argv[0]) || !enif_is_number(env, argv[1]) || !enif_is_list(env, argv[2])) {
         return enif_make_badarg(env);
     }
 
-    return NeuralTable::Increment(env, argv[0], argv[1], argv[2]);
-}
+    // Get table handle or bail
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) {
+        return enif_make_badarg(env);
+    }
 
-static ERL_NIF_TERM neural_shift(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::Shift(env, argv[0], argv[1], argv[2]);
+    // Get key value
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("increment", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "increment", entry_key);
+
+    if (!is_rerun() && !tb->admit(env, entry_key)) {
+        return make_overloaded(env);
+    }
+
+    // Acquire read/write lock for key
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule(env, "do_increment", neural_increment, argc, argv, trace);
+    }
+
+    // Try to read the value as it is
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        // Value exists
+        ERL_NIF_TERM op_cell;
+        const ERL_NIF_TERM *tb_tpl;
+        const ERL_NIF_TERM *op_tpl;
+        ERL_NIF_TERM *new_tpl, *dropped;
+        NeuralScratch::Scope scratch;
+        ErlNifEnv *bucket_env = tb->get_env(entry_key);
+        unsigned long int   pos         = 0;
+        long int            incr        = 0;
+        unsigned int        ops_length  = 0,
+                            dropped_count = 0;
+        int                 op_arity    = 0,
+                            tb_arity    = 0;
+
+        // Expand tuple to work on elements
+        enif_get_tuple(bucket_env, old, &tb_arity, &tb_tpl);
+
+        // Allocate space for a copy the contents of the table
+        // tuple and copy it in. All changes are to be made to
+        // the copy of the tuple, which lives until the end of
+        // this block.
+        new_tpl = NeuralScratch::Alloc<ERL_NIF_TERM>(tb_arity);
+        memcpy(new_tpl, tb_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
+
+        // Create empty list cell for return value.
+        ret = enif_make_list(env, 0);
+
+        // The values replaced, reclaimed once the new tuple is in.
+        enif_get_list_length(env, argv[2], &ops_length);
+        dropped = NeuralScratch::Alloc<ERL_NIF_TERM>(ops_length);
+
+        // Set iterator to first cell of ops
+        it = argv[2];
+        while(!enif_is_empty_list(env, it)) {
+            long int value = 0;
+            enif_get_list_cell(env, it, &op_cell, &it);             // op_cell = hd(it), it = tl(it)
+            enif_get_tuple(env, op_cell, &op_arity, &op_tpl);       // op_arity = tuple_size(op_cell), op_tpl = [TplPos1, TplPos2]
+            enif_get_ulong(env, op_tpl[0], &pos);                   // pos = (uint64)op_tpl[0]
+            enif_get_long(env, op_tpl[1], &incr);                   // incr = (uint64)op_tpl[1]
+
+            // Is the operation trying to modify a nonexistant
+            // position?
+            if (pos <= 0 || pos > tb_arity) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            // Is the operation trying to add to a value that's
+            // not a number?
+            if (!enif_is_number(bucket_env, new_tpl[pos - 1])) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            // Update the value stored in the tuple.
+            enif_get_long(env, new_tpl[pos - 1], &value);
+            dropped[dropped_count++] = new_tpl[pos - 1];
+            new_tpl[pos - 1] = enif_make_long(bucket_env, value + incr);
+
+            // Copy the new value to the head of the return list
+            ret = enif_make_list_cell(env, enif_make_copy(env, new_tpl[pos - 1]), ret);
+        }
+
+        if (tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity))) {
+            for (unsigned int i = 0; i < dropped_count; ++i) {
+                tb->reclaim(entry_key, dropped[i]);
+            }
+        } else {
+            ret = make_unstorable(env);
+        }
+
+    } else {
+        ret = enif_make_badarg(env);
+    }
+
+    // Bailout allows cancelling the update opertion
+    // in case something goes wrong. It must always
+    // come after tb->put and before rwunlock.
+bailout:
+    // Release the rwlock for entry_key
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
+/* ================================================================
+ * neural_unshift
+ * Processes a list of update operations. Each update operation is
+ * a tuple specifying the position of a list in the stored value to 
+ * update and a list of values to append. Elements are shifted from
+ * the input list to the stored list, so:
+ *
+ * unshift([a,b,c,d]) results in [d,c,b,a]
+ */
 static ERL_NIF_TERM neural_unshift(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::Unshift(env, argv[0], argv[1], argv[2]);
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old, it;
+    unsigned long int entry_key;
+    bool found;
+    ErlNifEnv *bucket_env;
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) {
+        return enif_make_badarg(env);
+    }
+
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("unshift", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "unshift", entry_key);
+
+    if (!is_rerun() && !tb->admit(env, entry_key)) {
+        return make_overloaded(env);
+    }
+
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule(env, "do_unshift", neural_unshift, argc, argv, trace);
+    }
+    bucket_env = tb->get_env(entry_key);
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        const ERL_NIF_TERM  *old_tpl,
+                            *op_tpl;
+        ERL_NIF_TERM        *new_tpl;
+        NeuralScratch::Scope scratch;
+        StagedTuple staged;
+        int tb_arity = 0,
+            op_arity = 0;
+        unsigned long pos = 0;
+        unsigned int new_length = 0;
+        ERL_NIF_TERM op,
+                     unshift,
+                     copy_it,
+                     copy_val;
+
+        // The new tuple is built in env, where the unshifted values
+        // live, and copied into the bucket once by put().
+        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
+        new_tpl = NeuralScratch::Alloc<ERL_NIF_TERM>(tb_arity);
+        for (int i = 0; i < tb_arity; ++i) {
+            new_tpl[i] = enif_make_copy(env, old_tpl[i]);
+        }
+
+        it = argv[2];
+        ret = enif_make_list(env, 0);
+
+        while (!enif_is_empty_list(env, it)) {
+            // Examine the operation.
+            enif_get_list_cell(env, it, &op, &it);          // op = hd(it), it = tl(it)
+            enif_get_tuple(env, op, &op_arity, &op_tpl);    // op_arity = tuple_size(op), op_tpl = [TplPos1, TplPos2]
+            enif_get_ulong(env, op_tpl[0], &pos);           // Tuple position to modify
+            unshift = op_tpl[1];                            // Values to unshfit
+
+            // Argument 1 of the operation tuple is position;
+            // make sure it's within the bounds of the tuple
+            // in the table.
+            if (pos <= 0 || pos > tb_arity) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+            
+            // Make sure we were passed a list of things to push
+            // onto the posth element of the entry
+            if (!enif_is_list(env, unshift)) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            // Now iterate over unshift, moving its values to
+            // the head of new_tpl[pos - 1] one by one.
+            copy_it = unshift;
+            while (!enif_is_empty_list(env, copy_it)) {
+                enif_get_list_cell(env, copy_it, &copy_val, &copy_it);
+                new_tpl[pos - 1] = enif_make_list_cell(env, copy_val, new_tpl[pos - 1]);
+            }
+            enif_get_list_length(env, new_tpl[pos - 1], &new_length);
+            ret = enif_make_list_cell(env, enif_make_uint(env, new_length), ret);
+        }
+
+        if (!tb->stage(env, entry_key, enif_make_tuple_from_array(env, new_tpl, tb_arity), staged)) {
+            ret = make_unstorable(env);
+            goto bailout;
+        }
+        if (!tb->put(env, entry_key, staged)) {
+            ret = make_unstorable(env);
+            goto bailout;
+        }
+
+    } else {
+        ret = enif_make_badarg(env);
+    }
+bailout:
+    tb->rwunlock(entry_key);
+
+    return ret;
+}
+
+static ERL_NIF_TERM neural_shift(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old, it;
+    unsigned long int entry_key;
+    bool found;
+    ErlNifEnv *bucket_env;
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) {
+        return enif_make_badarg(env);
+    }
+
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("shift", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "shift", entry_key);
+
+    if (!is_rerun() && !tb->admit(env, entry_key)) {
+        return make_overloaded(env);
+    }
+
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule(env, "do_shift", neural_shift, argc, argv, trace);
+    }
+    bucket_env = tb->get_env(entry_key);
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        const ERL_NIF_TERM *old_tpl;
+        const ERL_NIF_TERM *op_tpl;
+        ERL_NIF_TERM *new_tpl, *heads;
+        NeuralScratch::Scope scratch;
+        int tb_arity = 0,
+            op_arity = 0;
+        unsigned long pos = 0,
+                      count = 0,
+                      *taken;
+        unsigned int ops_length = 0,
+                     n = 0;
+        ERL_NIF_TERM op, list, shifted, dropped;
+
+        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
+        new_tpl = NeuralScratch::Alloc<ERL_NIF_TERM>(tb_arity);
+        memcpy(new_tpl, old_tpl, sizeof(ERL_NIF_TERM) * tb_arity);
+
+        // Where each op shifted from and how many values it took, for
+        // reclaiming them once the new tuple is in. They may live in
+        // another env than the bucket's, so they're kept here rather
+        // than in a list built there.
+        enif_get_list_length(env, argv[2], &ops_length);
+        heads = NeuralScratch::Alloc<ERL_NIF_TERM>(ops_length);
+        taken = NeuralScratch::Alloc<unsigned long>(ops_length);
+
+        it = argv[2];
+        ret = enif_make_list(env, 0);
+
+        while(!enif_is_empty_list(env, it)) {
+            enif_get_list_cell(env, it, &op, &it);
+            enif_get_tuple(env, op, &op_arity, &op_tpl);
+            enif_get_ulong(env, op_tpl[0], &pos);
+            enif_get_ulong(env, op_tpl[1], &count);
+
+            if (pos <= 0 || pos > tb_arity) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            if (!enif_is_list(env, new_tpl[pos -1])) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            shifted = enif_make_list(env, 0);
+            heads[n] = new_tpl[pos - 1];
+            taken[n] = 0;
+            if (count > 0) {
+                ERL_NIF_TERM copy_it = new_tpl[pos - 1],
+                             val;
+                int i = 0;
+                while (i < count && !enif_is_empty_list(bucket_env, copy_it)) {
+                    enif_get_list_cell(bucket_env, copy_it, &val, &copy_it);
+                    ++i;
+                    shifted = enif_make_list_cell(env, enif_make_copy(env, val), shifted);
+                    ++taken[n];
+                }
+                new_tpl[pos - 1] = copy_it;
+            } else if (count < 0) {
+                ERL_NIF_TERM copy_it = new_tpl[pos - 1],
+                             val;
+                while (!enif_is_empty_list(bucket_env, copy_it)) {
+                    enif_get_list_cell(bucket_env, copy_it, &val, &copy_it);
+                    shifted = enif_make_list_cell(env, enif_make_copy(env, val), shifted);
+                    ++taken[n];
+                }
+                new_tpl[pos - 1] = copy_it;
+            }
+            ret = enif_make_list_cell(env, shifted, ret);
+            ++n;
+        }
+
+        if (tb->put(entry_key, enif_make_tuple_from_array(bucket_env, new_tpl, tb_arity))) {
+            for (n = 0; n < ops_length; ++n) {
+                for (list = heads[n]; taken[n] > 0; --taken[n]) {
+                    enif_get_list_cell(bucket_env, list, &dropped, &list);
+                    tb->reclaim(entry_key, dropped);
+                }
+            }
+        } else {
+            ret = make_unstorable(env);
+        }
+    } else {
+        ret = enif_make_badarg(env);
+    }
+bailout:
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
-static ERL_NIF_TERM neural_swap(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]){
-    return NeuralTable::Swap(env, argv[0], argv[1], argv[2]);
+static ERL_NIF_TERM neural_swap(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, old, it;
+    unsigned long int entry_key;
+    bool found;
+    ErlNifEnv *bucket_env;
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) {
+        return enif_make_badarg(env);
+    }
+
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("swap", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "swap", entry_key);
+
+    if (!is_rerun() && !tb->admit(env, entry_key)) {
+        return make_overloaded(env);
+    }
+
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule(env, "do_swap", neural_swap, argc, argv, trace);
+    }
+    bucket_env = tb->get_env(entry_key);
+    found = tb->find(entry_key, old);
+    tb->count_op(entry_key, found);
+    if (found) {
+        const ERL_NIF_TERM *old_tpl;
+        const ERL_NIF_TERM *op_tpl;
+        ERL_NIF_TERM *new_tpl;
+        bool *swapped;
+        NeuralScratch::Scope scratch;
+        StagedTuple staged;
+        int tb_arity = 0,
+            op_arity = 0;
+        unsigned long pos = 0;
+        ERL_NIF_TERM op;
+
+        // The new tuple is built in env, where the values swapped in
+        // live, and copied into the bucket once by put().
+        enif_get_tuple(bucket_env, old, &tb_arity, &old_tpl);
+        new_tpl = NeuralScratch::Alloc<ERL_NIF_TERM>(tb_arity);
+        swapped = NeuralScratch::Alloc<bool>(tb_arity);
+        for (int i = 0; i < tb_arity; ++i) {
+            new_tpl[i] = enif_make_copy(env, old_tpl[i]);
+            swapped[i] = false;
+        }
+
+        it = argv[2];
+        ret = enif_make_list(env, 0);
+
+        while (!enif_is_empty_list(env, it)) {
+            enif_get_list_cell(env, it, &op, &it);
+            enif_get_tuple(env, op, &op_arity, &op_tpl);
+            enif_get_ulong(env, op_tpl[0], &pos);
+
+            if (pos <= 0 || pos > tb_arity) {
+                ret = enif_make_badarg(env);
+                goto bailout;
+            }
+
+            ret = enif_make_list_cell(env, new_tpl[pos - 1], ret);
+            new_tpl[pos - 1] = op_tpl[1];
+            swapped[pos - 1] = true;
+        }
+
+        if (!tb->stage(env, entry_key, enif_make_tuple_from_array(env, new_tpl, tb_arity), staged)) {
+            ret = make_unstorable(env);
+            goto bailout;
+        }
+        if (!tb->put(env, entry_key, staged)) {
+            ret = make_unstorable(env);
+            goto bailout;
+        }
+
+        // Only the stored values swapped out are garbage.
+        for (int i = 0; i < tb_arity; ++i) {
+            if (swapped[i]) {
+                tb->reclaim(entry_key, old_tpl[i]);
+            }
+        }
+    } else {
+        ret = enif_make_badarg(env);
+    }
+bailout:
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
 static ERL_NIF_TERM neural_get(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::Get(env, argv[0], argv[1]);
+    NeuralTable *tb;
+    ERL_NIF_TERM ret, val;
+    unsigned long int entry_key;
+    bool found;
+
+    // Acquire table handle, or quit if the table doesn't exist.
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    // Get key value
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("lookup", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "lookup", entry_key);
+
+    // Lock the key
+    if (!tb->try_rlock(entry_key)) {
+        return reschedule(env, "do_fetch", neural_get, argc, argv, trace);
+    }
+
+    // Faulting a spilled entry back in modifies the bucket, which
+    // needs the write lock.
+    if (!tb->resident(entry_key)) {
+        tb->runlock(entry_key);
+        if (!tb->try_rwlock(entry_key)) {
+            return reschedule(env, "do_fetch", neural_get, argc, argv, trace);
+        }
+        found = tb->find(entry_key, val);
+        tb->count_op(entry_key, found);
+        if (!found) {
+            ret = enif_make_atom(env, "undefined");
+        } else {
+            ret = enif_make_copy(env, val);
+        }
+        tb->rwunlock(entry_key);
+
+        return ret;
+    }
+
+    // Copy the current value straight out
+    found = tb->read(entry_key, env, ret);
+    tb->count_op(entry_key, found);
+    if (!found) {
+        ret = enif_make_atom(env, "undefined");
+    }
+
+    tb->runlock(entry_key);
+
+    return ret;
 }
 
 static ERL_NIF_TERM neural_delete(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
-    return NeuralTable::Delete(env, argv[0], argv[1]);
+    NeuralTable *tb;
+    ERL_NIF_TERM val, ret;
+    unsigned long int entry_key;
+    bool found;
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    enif_get_ulong(env, argv[1], &entry_key);
+    NEURAL_OP_PROBE("delete", entry_key);
+    NeuralTraceScope trace(tb->get_tracer(), "delete", entry_key);
+
+    if (!tb->try_rwlock(entry_key)) {
+        return reschedule(env, "do_delete", neural_delete, argc, argv, trace);
+    }
+
+    found = tb->erase(entry_key, val);
+    tb->count_op(entry_key, found);
+    if (found) {
+        tb->reclaim(entry_key, val);
+        ret = enif_make_copy(env, val);
+    } else {
+        ret = enif_make_atom(env, "undefined");
+    }
+
+    tb->rwunlock(entry_key);
+
+    return ret;
 }
 
 static ERL_NIF_TERM neural_empty(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
     if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::Empty(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    tb->clear();
+
+    return enif_make_atom(env, "ok");
 }
 
 static ERL_NIF_TERM neural_dump(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ErlNifPid self;
+
     if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::Dump(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    enif_self(env, &self);
+
+    tb->add_batch_job(self, &NeuralTable::batch_dump, "dump");
+
+    return enif_make_atom(env, "$neural_batch_wait");
 }
 
 static ERL_NIF_TERM neural_drain(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ErlNifPid self;
+
     if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::Drain(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    enif_self(env, &self);
+
+    tb->add_batch_job(self, &NeuralTable::batch_drain, "drain");
+
+    return enif_make_atom(env, "$neural_batch_wait");
 }
 
 static ERL_NIF_TERM neural_garbage(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    tb->collect();
+
+    return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM neural_gc_pause(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    tb->gc_pause();
+
+    return enif_make_atom(env, "ok");
+}
+
+static ERL_NIF_TERM neural_gc_resume(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
     if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::GarbageCollect(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    tb->gc_resume();
+
+    return enif_make_atom(env, "ok");
+}
+
+/* ================================================================
+ * neural_compact
+ * Queues a collection of one bucket, or of all of them, on the batch
+ * thread. The result follows as a batch response.
+ */
+static ERL_NIF_TERM neural_compact(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ErlNifPid self;
+    BatchArgs args;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+    if (!enif_is_identical(argv[1], enif_make_atom(env, "all"))
+            && (!enif_get_int(env, argv[1], &args.bucket) || args.bucket < 0 || args.bucket >= BUCKET_COUNT)) {
+        return enif_make_badarg(env);
+    }
+    if (!enif_get_ulong(env, argv[2], &args.min_garbage)) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    enif_self(env, &self);
+
+    tb->add_batch_job(self, &NeuralTable::batch_compact, "compact", args);
+
+    return enif_make_atom(env, "$neural_batch_wait");
+}
+
+/* ================================================================
+ * neural_alloc_count
+ * Returns how many heap allocations the NIF has made so far, or
+ * undefined unless it was built with -DNEURAL_ALLOC_COUNT.
+ */
+static ERL_NIF_TERM neural_alloc_count(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    unsigned long int count;
+
+    if (!alloc_count(count)) {
+        return enif_make_atom(env, "undefined");
+    }
+    return enif_make_ulong(env, count);
 }
 
 static ERL_NIF_TERM neural_garbage_size(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
     if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
 
-    return NeuralTable::GarbageSize(env, argv[0]);
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    return enif_make_ulong(env, tb->garbage_size());
+}
+
+/* ================================================================
+ * neural_checkpoint
+ * Flushes a persistent table to disk.
+ */
+static ERL_NIF_TERM neural_checkpoint(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL || !tb->persistent()) { return enif_make_badarg(env); }
+
+    return enif_make_atom(env, tb->checkpoint() ? "ok" : "error");
+}
+
+/* ================================================================
+ * neural_gc_stats
+ * Returns a {Runs, Micros, BytesReclaimed} tuple for every bucket,
+ * in bucket order.
+ */
+static ERL_NIF_TERM neural_gc_stats(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ERL_NIF_TERM ret;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    ret = enif_make_list(env, 0);
+    for (int i = BUCKET_COUNT - 1; i >= 0; --i) {
+        const GcStats &stats = tb->get_gc_stats(i);
+        ret = enif_make_list_cell(env, enif_make_tuple3(env,
+                    enif_make_ulong(env, stats.runs.load(memory_order_relaxed)),
+                    enif_make_ulong(env, stats.micros.load(memory_order_relaxed)),
+                    enif_make_ulong(env, stats.reclaimed.load(memory_order_relaxed))), ret);
+    }
+
+    return ret;
+}
+
+/* ================================================================
+ * neural_telemetry
+ * Subscribes pid to periodic telemetry messages from the table, one
+ * every interval milliseconds; an interval of 0 unsubscribes it.
+ */
+static ERL_NIF_TERM neural_telemetry(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    ErlNifPid pid;
+    unsigned int interval;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+    if (!enif_get_local_pid(env, argv[1], &pid)) { return enif_make_badarg(env); }
+    if (!enif_get_uint(env, argv[2], &interval)) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    tb->subscribe(pid, interval);
+
+    return enif_make_atom(env, "ok");
+}
+
+/* ================================================================
+ * neural_trace_dump
+ * Returns the ops held in the table's trace ring, oldest first, as
+ * {Op, Shard, Key, LockWaitNs, DurationNs, StartNs} tuples. StartNs
+ * is on the clock of erlang:monotonic_time(nanosecond).
+ */
+static ERL_NIF_TERM neural_trace_dump(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    vector<TraceRecord> records;
+    ERL_NIF_TERM ret;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL || tb->get_tracer() == NULL) { return enif_make_badarg(env); }
+
+    tb->get_tracer()->snapshot(records);
+
+    ret = enif_make_list(env, 0);
+    for (vector<TraceRecord>::reverse_iterator it = records.rbegin(); it != records.rend(); ++it) {
+        ret = enif_make_list_cell(env, enif_make_tuple6(env,
+                    enif_make_atom(env, it->op),
+                    enif_make_int(env, GET_BUCKET(it->key)),
+                    enif_make_ulong(env, it->key),
+                    enif_make_ulong(env, it->lock_wait),
+                    enif_make_ulong(env, it->duration),
+                    enif_make_int64(env, it->start)), ret);
+    }
+
+    return ret;
+}
+
+/* ================================================================
+ * neural_hot_keys
+ * Returns up to n {KeyHash, Shard, AccessesPerSec, WritesPerSec}
+ * tuples for the table's busiest keys, busiest first.
+ */
+static ERL_NIF_TERM neural_hot_keys(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    vector<HotKeyRate> keys;
+    unsigned int n;
+    ERL_NIF_TERM ret;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+    if (!enif_get_uint(env, argv[1], &n)) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL || !tb->tracks_hot_keys()) { return enif_make_badarg(env); }
+
+    tb->top_keys(n, keys);
+
+    ret = enif_make_list(env, 0);
+    for (vector<HotKeyRate>::reverse_iterator it = keys.rbegin(); it != keys.rend(); ++it) {
+        ret = enif_make_list_cell(env, enif_make_tuple4(env,
+                    enif_make_ulong(env, it->key),
+                    enif_make_int(env, it->bucket),
+                    enif_make_double(env, it->accesses),
+                    enif_make_double(env, it->writes)), ret);
+    }
+
+    return ret;
+}
+
+/* ================================================================
+ * neural_set_opts
+ * Changes options of a live table. Only the GC policy options can be
+ * changed; the whole list is checked before any of it is applied.
+ */
+static ERL_NIF_TERM neural_set_opts(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[]) {
+    NeuralTable *tb;
+    GcPolicy policy;
+    int arity = 0;
+    const ERL_NIF_TERM *opt_tpl;
+    ERL_NIF_TERM opt, it;
+
+    if (!enif_is_atom(env, argv[0])) { return enif_make_badarg(env); }
+
+    tb = get_table(env, argv[0]);
+    if (tb == NULL) { return enif_make_badarg(env); }
+
+    policy = tb->get_gc_policy();
+    it = argv[1];
+    while (enif_get_list_cell(env, it, &opt, &it)) {
+        if (!enif_get_tuple(env, opt, &arity, &opt_tpl) || arity != 2 || !is_gc_option(env, opt_tpl[0])) {
+            return enif_make_badarg(env);
+        }
+        if (!get_gc_option(env, opt_tpl, policy)) {
+            return enif_make_badarg(env);
+        }
+    }
+    tb->set_gc_policy(policy);
+
+    return enif_make_atom(env, "ok");
 }
 
 static void neural_resource_cleanup(ErlNifEnv* env, void* arg)
@@ -124,6 +1259,7 @@ static void neural_resource_cleanup(ErlNifEnv* env, void* arg)
 static int on_load(ErlNifEnv* env, void** priv_data, ERL_NIF_TERM load_info)
 {
     NeuralTable::Initialize();
+    staged_type = enif_open_resource_type(env, NULL, "neural_staged", destroy_staged, ERL_NIF_RT_CREATE, NULL);
     return 0;
 }
 
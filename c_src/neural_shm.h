@@ -0,0 +1,210 @@
+#ifndef NEURAL_SHM_H
+#define NEURAL_SHM_H
+
+/* Layout of the shared memory segment a NEURAL table mirrors itself
+ * into when created with {export, Name}, and a header-only reader for
+ * processes outside the BEAM. The reader needs nothing but this file
+ * and POSIX shared memory (link with -lrt on older glibc).
+ *
+ * Every stored tuple gets a slot holding its integer fields. Slots
+ * are grouped by the NEURAL bucket the key hashes to, and each group
+ * is an open addressing table probed linearly from key / 64. Each
+ * slot is guarded by a seqlock: the writer makes seq odd, updates the
+ * slot, then makes seq even again, and readers retry until they see
+ * the same even seq before and after copying the slot out.
+ */
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define NEURAL_SHM_MAGIC 0x314d48534c52554eULL
+#define NEURAL_SHM_VERSION 1
+#define NEURAL_SHM_BUCKETS 64
+#define NEURAL_SHM_FIELDS 16
+#define NEURAL_SHM_NAME 40
+
+#define NEURAL_SHM_FREE 0
+#define NEURAL_SHM_LIVE 1
+#define NEURAL_SHM_DELETED 2
+
+struct NeuralShmHeader {
+    uint64_t                magic;
+    uint32_t                version;
+    uint32_t                key_pos;
+    uint64_t                bucket_slots;       // slots per bucket, a power of two
+    std::atomic<uint32_t>   alive;              // cleared when the table goes away
+    uint32_t                pad;
+};
+
+struct NeuralShmSlot {
+    std::atomic<uint32_t>   seq;
+    uint32_t                state;
+    uint64_t                key;                // erlang:phash2/1 of the key
+    uint32_t                arity;              // tuple size, fields past NEURAL_SHM_FIELDS are dropped
+    uint32_t                int_mask;           // bit N set if element N + 1 is an integer
+    char                    name[NEURAL_SHM_NAME];  // the key if it is a short atom, binary or string
+    int64_t                 values[NEURAL_SHM_FIELDS];
+};
+
+// A consistent copy of one slot.
+struct NeuralShmRecord {
+    uint64_t    key;
+    uint32_t    arity;
+    uint32_t    int_mask;
+    char        name[NEURAL_SHM_NAME];
+    int64_t     values[NEURAL_SHM_FIELDS];
+
+    // Element pos of the tuple, counted from 1 as in Erlang.
+    bool get(unsigned int pos, int64_t &value) const {
+        if (pos < 1 || pos > arity || pos > NEURAL_SHM_FIELDS || !(int_mask & (1U << (pos - 1)))) {
+            return false;
+        }
+        value = values[pos - 1];
+        return true;
+    }
+};
+
+static inline size_t neural_shm_size(uint64_t bucket_slots) {
+    return sizeof(NeuralShmHeader) + NEURAL_SHM_BUCKETS * bucket_slots * sizeof(NeuralShmSlot);
+}
+
+class NeuralShmReader {
+    public:
+        NeuralShmReader() : header(NULL), slots(NULL), size(0) { }
+        ~NeuralShmReader() { close(); }
+
+        // Attaches to the segment exported under name, e.g. "/counters".
+        bool open(const char *name) {
+            struct stat st;
+            void *map;
+            int fd = shm_open(name, O_RDONLY, 0);
+
+            close();
+            if (fd < 0) {
+                return false;
+            }
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(NeuralShmHeader)) {
+                ::close(fd);
+                return false;
+            }
+
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (map == MAP_FAILED) {
+                return false;
+            }
+
+            header = (const NeuralShmHeader*)map;
+            size = st.st_size;
+            if (header->magic != NEURAL_SHM_MAGIC
+                    || header->version != NEURAL_SHM_VERSION
+                    || neural_shm_size(header->bucket_slots) > size) {
+                close();
+                return false;
+            }
+            slots = (const NeuralShmSlot*)(header + 1);
+
+            return true;
+        }
+
+        void close() {
+            if (header != NULL) {
+                munmap((void*)header, size);
+                header = NULL;
+                slots = NULL;
+            }
+        }
+
+        // True once the exporting table is gone; reopen to follow a new one.
+        bool stale() const {
+            return header == NULL || !header->alive.load(std::memory_order_acquire);
+        }
+
+        // Looks up an entry by the erlang:phash2/1 hash of its key.
+        bool read(uint64_t key, NeuralShmRecord &out) const {
+            if (header == NULL) {
+                return false;
+            }
+
+            uint64_t mask = header->bucket_slots - 1;
+            uint64_t at = (key / NEURAL_SHM_BUCKETS) & mask;
+            const NeuralShmSlot *group = slots + (key % NEURAL_SHM_BUCKETS) * header->bucket_slots;
+            uint32_t state;
+
+            for (uint64_t n = 0; n <= mask; ++n, at = (at + 1) & mask) {
+                if (!snapshot(group[at], state, out) || state == NEURAL_SHM_FREE) {
+                    return false;
+                }
+                if (state == NEURAL_SHM_LIVE && out.key == key) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        // Looks up an entry by its key's name. Scans every slot.
+        bool find(const char *name, NeuralShmRecord &out) const {
+            bool found = false;
+            for_each([&](const NeuralShmRecord &rec) {
+                if (!found && strncmp(rec.name, name, NEURAL_SHM_NAME) == 0) {
+                    out = rec;
+                    found = true;
+                }
+            });
+            return found;
+        }
+
+        // Calls fun with a consistent copy of every live entry.
+        template <class Fun> void for_each(Fun fun) const {
+            if (header == NULL) {
+                return;
+            }
+
+            uint64_t total = NEURAL_SHM_BUCKETS * header->bucket_slots;
+            NeuralShmRecord rec;
+            uint32_t state;
+
+            for (uint64_t n = 0; n < total; ++n) {
+                if (snapshot(slots[n], state, rec) && state == NEURAL_SHM_LIVE) {
+                    fun(rec);
+                }
+            }
+        }
+
+    protected:
+        // Copies a slot out under its seqlock. Gives up after a bounded
+        // number of retries in case the writer died mid-update.
+        static bool snapshot(const NeuralShmSlot &slot, uint32_t &state, NeuralShmRecord &out) {
+            for (int tries = 0; tries < 1000; ++tries) {
+                uint32_t before = slot.seq.load(std::memory_order_acquire);
+                if (before & 1) {
+                    continue;
+                }
+
+                state = slot.state;
+                out.key = slot.key;
+                out.arity = slot.arity;
+                out.int_mask = slot.int_mask;
+                memcpy(out.name, slot.name, NEURAL_SHM_NAME);
+                memcpy(out.values, slot.values, sizeof(out.values));
+
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.seq.load(std::memory_order_relaxed) == before) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const NeuralShmHeader *header;
+        const NeuralShmSlot *slots;
+        size_t size;
+};
+
+#endif
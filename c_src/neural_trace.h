@@ -0,0 +1,58 @@
+#ifndef NEURAL_TRACE_H
+#define NEURAL_TRACE_H
+
+/* USDT probes for perf, bpftrace and friends. Build with
+ * -DNEURAL_USDT to compile them in (needs sys/sdt.h, from systemtap's
+ * sdt development package); otherwise they compile to nothing.
+ *
+ * Probes, all under the provider "neural":
+ *
+ *   op__entry(op, key)                 a NIF call has its key
+ *   op__return(op, key)                and is about to return
+ *   lock__contended(bucket, write)     a bucket lock was busy
+ *   lock__acquire(bucket, write)       a bucket lock was taken
+ *   lock__release(bucket, write)       and released
+ *   gc__start(bucket)                  a bucket is being collected
+ *   gc__done(bucket, micros, bytes)    and has been
+ *   batch__start(job)                  a batch job ("dump", "compact", ...)
+ *   batch__done(job)                   has started or finished
+ *
+ * op and job are C strings. write is 1 for the write lock.
+ */
+
+#ifdef NEURAL_USDT
+
+#include <sys/sdt.h>
+
+#define NEURAL_PROBE1(name, a)          DTRACE_PROBE1(neural, name, a)
+#define NEURAL_PROBE2(name, a, b)       DTRACE_PROBE2(neural, name, a, b)
+#define NEURAL_PROBE3(name, a, b, c)    DTRACE_PROBE3(neural, name, a, b, c)
+
+// Fires op__entry where it is declared and op__return when the
+// enclosing scope is left, whichever way that happens.
+class NeuralOpProbe {
+    public:
+        NeuralOpProbe(const char *op, unsigned long int key) : op(op), key(key) {
+            DTRACE_PROBE2(neural, op__entry, op, key);
+        }
+        ~NeuralOpProbe() {
+            DTRACE_PROBE2(neural, op__return, op, key);
+        }
+
+    protected:
+        const char *op;
+        unsigned long int key;
+};
+
+#define NEURAL_OP_PROBE(op, key)        NeuralOpProbe neural_op_probe(op, key)
+
+#else
+
+#define NEURAL_PROBE1(name, a)          do { } while (0)
+#define NEURAL_PROBE2(name, a, b)       do { } while (0)
+#define NEURAL_PROBE3(name, a, b, c)    do { } while (0)
+#define NEURAL_OP_PROBE(op, key)        do { } while (0)
+
+#endif
+
+#endif
@@ -1,4 +1,33 @@
 #include "neural_utils.h"
+#include <zlib.h>
+#include <new>
+#include <stdlib.h>
+
+#ifdef NEURAL_ALLOC_COUNT
+std::atomic<unsigned long int> alloc_total(0);
+
+void* operator new(size_t size) {
+    void *ret = malloc(size > 0 ? size : 1);
+    if (ret == NULL) {
+        throw std::bad_alloc();
+    }
+    count_alloc();
+    return ret;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+bool alloc_count(unsigned long int &ret) {
+    ret = alloc_total.load(std::memory_order_relaxed);
+    return true;
+}
+#else
+bool alloc_count(unsigned long int &ret) {
+    return false;
+}
+#endif
 
 unsigned long int estimate_size(ErlNifEnv *env, ERL_NIF_TERM term) {
     if (enif_is_atom(env, term)) {
@@ -43,4 +72,74 @@ unsigned long int estimate_size(ErlNifEnv *env, ERL_NIF_TERM term) {
     return WORD_SIZE;
 }
 
+/* Serializes term and deflates it into a new binary in env. Fails if
+ * compression would save less than a tenth of the serialized size.
+ */
+bool compress_term(ErlNifEnv *env, ERL_NIF_TERM term, ERL_NIF_TERM &ret, unsigned int &raw_size) {
+    ErlNifBinary raw, packed;
+    uLongf len;
+
+    if (!enif_term_to_binary(env, term, &raw)) {
+        return false;
+    }
+
+    len = compressBound(raw.size);
+    if (!enif_alloc_binary(len, &packed)) {
+        enif_release_binary(&raw);
+        return false;
+    }
+
+    if (compress2(packed.data, &len, raw.data, raw.size, Z_DEFAULT_COMPRESSION) != Z_OK || len * 10 > raw.size * 9) {
+        enif_release_binary(&packed);
+        enif_release_binary(&raw);
+        return false;
+    }
 
+    raw_size = raw.size;
+    enif_release_binary(&raw);
+    enif_realloc_binary(&packed, len);
+    ret = enif_make_binary(env, &packed);
+
+    return true;
+}
+
+bool inflate_term(ErlNifEnv *env, ERL_NIF_TERM packed, unsigned int raw_size, ERL_NIF_TERM &ret) {
+    ErlNifBinary bin;
+    unsigned char *raw;
+    uLongf len = raw_size;
+    bool ok;
+
+    if (!enif_inspect_binary(env, packed, &bin)) {
+        return false;
+    }
+
+    raw = (unsigned char*)enif_alloc(raw_size);
+    ok = uncompress(raw, &len, bin.data, bin.size) == Z_OK
+        && len == raw_size
+        && enif_binary_to_term(env, raw, raw_size, &ret, 0) > 0;
+    enif_free(raw);
+
+    return ok;
+}
+
+/* ================================================================
+ * sample_one_in
+ * True for roughly 1 in n calls, never for n = 0. Each thread draws
+ * from its own generator, so sampling never touches shared memory.
+ */
+bool sample_one_in(unsigned int n) {
+    static thread_local unsigned long int state = 0;
+
+    if (n == 0) {
+        return false;
+    }
+    if (state == 0) {
+        state = ((unsigned long int)&state ^ (unsigned long int)enif_monotonic_time(ERL_NIF_NSEC)) | 1;
+    }
+    // xorshift64
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return state % n == 0;
+}
@@ -2,8 +2,25 @@
 #define NEURAL_UTILS_H
 
 #include "erl_nif.h"
+#include <atomic>
 #define WORD_SIZE sizeof(int)
 
+/* Building with -DNEURAL_ALLOC_COUNT counts the heap allocations the
+ * NIF makes: every operator new, and the enif_alloc calls that report
+ * themselves through count_alloc(). alloc_count() returns false in
+ * other builds.
+ */
+#ifdef NEURAL_ALLOC_COUNT
+extern std::atomic<unsigned long int> alloc_total;
+inline void count_alloc() { alloc_total.fetch_add(1, std::memory_order_relaxed); }
+#else
+inline void count_alloc() { }
+#endif
+bool alloc_count(unsigned long int &ret);
+
 unsigned long int estimate_size(ErlNifEnv *env, ERL_NIF_TERM term);
+bool compress_term(ErlNifEnv *env, ERL_NIF_TERM term, ERL_NIF_TERM &ret, unsigned int &raw_size);
+bool inflate_term(ErlNifEnv *env, ERL_NIF_TERM packed, unsigned int raw_size, ERL_NIF_TERM &ret);
+bool sample_one_in(unsigned int n);
 
 #endif
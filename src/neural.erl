@@ -2,16 +2,36 @@
 
 -export([new/2, empty/1, drain/1, dump/1,       % Table operations
          garbage/1, garbage_size/1, 
-         key_pos/1]).
+         key_pos/1, checkpoint/1, gc_stats/1,
+         telemetry/3, trace_dump/1, hot_keys/2, set_opts/2,
+         gc_pause/1, gc_resume/1, compact/3,
+         alloc_count/0]).
 -export([lookup/2]).                            % Getters
 -export([insert/2, insert_new/2, delete/2]).    % Setters
 -export([increment/3, unshift/3, shift/3, swap/3]).     % Delta operations
 -on_load(init/0).
 -record(table_opts, {
-        keypos      = 1 :: integer()
+        keypos      = 1 :: integer(),
+        engine      = undefined :: undefined | env | serialized,
+        tier        = undefined :: undefined | string(),
+        tier_idle   = 300 :: integer(),
+        compress    = undefined :: undefined | integer(),
+        compress_idle = 60 :: integer(),
+        persist     = undefined :: undefined | string(),
+        export      = undefined :: undefined | string(),
+        export_slots = undefined :: undefined | integer(),
+        trace_sample = undefined :: undefined | integer(),
+        trace_slow  = undefined :: undefined | integer(),
+        trace_size  = undefined :: undefined | integer(),
+        hot_keys    = undefined :: undefined | integer(),
+        tenure      = undefined :: undefined | integer(),
+        large_object = undefined :: undefined | integer(),
+        gc          = [] :: [{gc | gc_interval | gc_parallelism | garbage_soft_limit | garbage_hard_limit, term()}]
     }).
 
 -define(nif_stub, nif_stub_error(?LINE)).
+% Binary fields at least this big are checked for being slices.
+-define(SLICE_THRESHOLD, 4096).
 nif_stub_error(Line) ->
     erlang:nif_error({nif_not_loaded,module,?MODULE,line,Line}).
 
@@ -35,76 +55,148 @@ new(Table, Opts) ->
 
 new(Table, [{key_pos, KeyPos}|Opts], TableOpts) ->
     new(Table, Opts, TableOpts#table_opts{keypos = KeyPos});
-new(Table, [], _TableOpts = #table_opts{keypos = KeyPos}) when is_integer(KeyPos) ->
-    make_table(Table, KeyPos).
+new(Table, [{engine, Engine}|Opts], TableOpts) when Engine =:= env; Engine =:= serialized ->
+    new(Table, Opts, TableOpts#table_opts{engine = Engine});
+new(Table, [{tier, Dir}|Opts], TableOpts) when is_list(Dir) ->
+    new(Table, Opts, TableOpts#table_opts{tier = Dir});
+new(Table, [{tier_idle, Secs}|Opts], TableOpts) when is_integer(Secs), Secs > 0 ->
+    new(Table, Opts, TableOpts#table_opts{tier_idle = Secs});
+new(Table, [{compress, MinBytes}|Opts], TableOpts) when is_integer(MinBytes), MinBytes > 0 ->
+    new(Table, Opts, TableOpts#table_opts{compress = MinBytes});
+new(Table, [{compress_idle, Secs}|Opts], TableOpts) when is_integer(Secs), Secs > 0 ->
+    new(Table, Opts, TableOpts#table_opts{compress_idle = Secs});
+new(Table, [{persist, File}|Opts], TableOpts) when is_list(File) ->
+    new(Table, Opts, TableOpts#table_opts{persist = File});
+new(Table, [{export, [$/|_] = ShmName}|Opts], TableOpts) ->
+    new(Table, Opts, TableOpts#table_opts{export = ShmName});
+new(Table, [{export_slots, Slots}|Opts], TableOpts) when is_integer(Slots), Slots > 0 ->
+    new(Table, Opts, TableOpts#table_opts{export_slots = Slots});
+new(Table, [{trace_sample, Rate}|Opts], TableOpts) when is_integer(Rate), Rate > 0 ->
+    new(Table, Opts, TableOpts#table_opts{trace_sample = Rate});
+new(Table, [{trace_slow, Micros}|Opts], TableOpts) when is_integer(Micros), Micros > 0 ->
+    new(Table, Opts, TableOpts#table_opts{trace_slow = Micros});
+new(Table, [{trace_size, Size}|Opts], TableOpts) when is_integer(Size), Size > 0 ->
+    new(Table, Opts, TableOpts#table_opts{trace_size = Size});
+new(Table, [{hot_keys, Rate}|Opts], TableOpts) when is_integer(Rate), Rate > 0 ->
+    new(Table, Opts, TableOpts#table_opts{hot_keys = Rate});
+new(Table, [{tenure, Age}|Opts], TableOpts) when is_integer(Age), Age >= 0, Age =< 255 ->
+    new(Table, Opts, TableOpts#table_opts{tenure = Age});
+new(Table, [{large_object, MinBytes}|Opts], TableOpts) when is_integer(MinBytes), MinBytes >= 0 ->
+    new(Table, Opts, TableOpts#table_opts{large_object = MinBytes});
+new(Table, [Opt = {gc, _}|Opts], TableOpts = #table_opts{gc = GcOpts}) ->
+    new(Table, Opts, TableOpts#table_opts{gc = GcOpts ++ [gc_opt(Opt)]});
+new(Table, [Opt = {gc_interval, _}|Opts], TableOpts = #table_opts{gc = GcOpts}) ->
+    new(Table, Opts, TableOpts#table_opts{gc = GcOpts ++ [gc_opt(Opt)]});
+new(Table, [Opt = {gc_parallelism, _}|Opts], TableOpts = #table_opts{gc = GcOpts}) ->
+    new(Table, Opts, TableOpts#table_opts{gc = GcOpts ++ [gc_opt(Opt)]});
+new(Table, [Opt = {garbage_soft_limit, _}|Opts], TableOpts = #table_opts{gc = GcOpts}) ->
+    new(Table, Opts, TableOpts#table_opts{gc = GcOpts ++ [gc_opt(Opt)]});
+new(Table, [Opt = {garbage_hard_limit, _}|Opts], TableOpts = #table_opts{gc = GcOpts}) ->
+    new(Table, Opts, TableOpts#table_opts{gc = GcOpts ++ [gc_opt(Opt)]});
+new(Table, [], TableOpts = #table_opts{keypos = KeyPos}) when is_integer(KeyPos) ->
+    make_table(Table, KeyPos, nif_opts(TableOpts)).
+
+%% Options the NIF needs beyond the key position, as {Name, Value} pairs.
+nif_opts(#table_opts{engine = Engine, tier = Tier, tier_idle = TierIdle, compress = Compress, compress_idle = CompressIdle,
+                     persist = Persist, export = Export, export_slots = ExportSlots,
+                     trace_sample = TraceSample, trace_slow = TraceSlow, trace_size = TraceSize,
+                     hot_keys = HotKeys, tenure = Tenure, large_object = LargeObject, gc = GcOpts}) ->
+    [ Opt || Opt = {_, Value} <- [{engine, Engine}, {tier, Tier}, {tier_idle, TierIdle},
+                                  {compress, Compress}, {compress_idle, CompressIdle},
+                                  {persist, Persist},
+                                  {export, Export}, {export_slots, ExportSlots},
+                                  {trace_sample, TraceSample}, {trace_slow, TraceSlow}, {trace_size, TraceSize},
+                                  {hot_keys, HotKeys}, {tenure, Tenure}, {large_object, LargeObject}],
+             Value =/= undefined ] ++ GcOpts.
+
+%% Checks a GC policy option, and hands ratios to the NIF as floats.
+gc_opt({gc, {bytes, Bytes}}) when is_integer(Bytes), Bytes > 0 -> {gc, {bytes, Bytes}};
+gc_opt({gc, {ratio, Ratio}}) when is_number(Ratio), Ratio > 0 -> {gc, {ratio, float(Ratio)}};
+gc_opt({gc, adaptive}) -> {gc, adaptive};
+gc_opt({gc_interval, Ms}) when is_integer(Ms), Ms >= 0 -> {gc_interval, Ms};
+gc_opt({gc_parallelism, N}) when is_integer(N), N > 0 -> {gc_parallelism, N};
+gc_opt({garbage_soft_limit, Bytes}) when is_integer(Bytes), Bytes >= 0 -> {garbage_soft_limit, Bytes};
+gc_opt({garbage_hard_limit, Bytes}) when is_integer(Bytes), Bytes >= 0 -> {garbage_hard_limit, Bytes};
+gc_opt(_Opt) -> error(badarg).
+
+%% Changes the GC policy of a live table; takes the {gc, _},
+%% {gc_interval, _}, {gc_parallelism, _}, {garbage_soft_limit, _} and
+%% {garbage_hard_limit, _} options of new/2.
+set_opts(Table, Opts) when is_atom(Table), is_list(Opts) ->
+    do_set_opts(Table, [ gc_opt(Opt) || Opt <- Opts ]).
+
+do_set_opts(_Table, _Opts) ->
+    ?nif_stub.
 
-make_table(_Table, _KeyPos) ->
+make_table(_Table, _KeyPos, _Opts) ->
     ?nif_stub.
 
 insert(Table, Object) when is_atom(Table), is_tuple(Object) ->
     Key = element(key_pos(Table), Object),
-    insert(Table, erlang:phash2(Key), Object).
+    insert(Table, erlang:phash2(Key), unslice(Object)).
 
 insert(_Table, _Key, _Object) ->
     ?nif_stub.
 
 insert_new(Table, Object) when is_atom(Table), is_tuple(Object) ->
     Key = element(key_pos(Table), Object),
-    insert_new(Table, erlang:phash2(Key), Object).
+    insert_new(Table, erlang:phash2(Key), unslice(Object)).
 
 insert_new(_Table, _Key, _Object) ->
     ?nif_stub.
 
 increment(Table, Key, Value) when is_integer(Value) ->
-    [N] = increment(Table, Key, [{key_pos(Table) + 1, Value}]),
-    N;
+    only(increment(Table, Key, [{key_pos(Table) + 1, Value}]));
 increment(Table, Key, Op = {Position, Value}) when is_integer(Position), is_integer(Value) ->
-    [N] = increment(Table, Key, [Op]),
-    N;
+    only(increment(Table, Key, [Op]));
 increment(Table, Key, Op = [_|_]) when is_atom(Table) ->
     case lists:all(fun is_incr_op/1, Op) of
         true ->
-            lists:reverse(do_increment(Table, erlang:phash2(Key), Op));
+            reverse(do_increment(Table, erlang:phash2(Key), Op));
         false ->
             error(badarg)
     end.
 
 shift(Table, Key, Value) when is_integer(Value) ->
-    [R] = shift(Table, Key, [{key_pos(Table) + 1, Value}]),
-    R;
+    only(shift(Table, Key, [{key_pos(Table) + 1, Value}]));
 shift(Table, Key, Op = {Position, Value}) when is_integer(Position), is_integer(Value) ->
-    [R] = shift(Table, Key, [Op]),
-    R;
+    only(shift(Table, Key, [Op]));
 shift(Table, Key, Op = [_|_]) when is_atom(Table) ->
     case lists:all(fun is_shift_op/1, Op) of
         true ->
-            lists:reverse(do_shift(Table, erlang:phash2(Key), Op));
+            reverse(do_shift(Table, erlang:phash2(Key), Op));
         false ->
             error(badarg)
     end.
 
 unshift(Table, Key, Op = {Position, Value}) when is_integer(Position), is_list(Value) ->
-    [R] = unshift(Table, Key, [Op]),
-    R;
+    only(unshift(Table, Key, [Op]));
 unshift(Table, Key, Op = [_|_]) when is_atom(Table) ->
     case lists:all(fun is_unshift_op/1, Op) of
         true ->
-            lists:reverse(do_unshift(Table, erlang:phash2(Key), Op), []);
+            reverse(do_unshift(Table, erlang:phash2(Key), Op));
         false ->
             error(badarg)
     end.
 
 swap(Table, Key, Op = {Position, _Value}) when is_integer(Position) ->
-    [R] = swap(Table, Key, [Op]),
-    R;
+    only(swap(Table, Key, [Op]));
 swap(Table, Key, Op = [_|_]) when is_atom(Table) ->
     case lists:all(fun is_swap_op/1, Op) of 
         true ->
-            lists:reverse(do_swap(Table, erlang:phash2(Key), Op));
+            reverse(do_swap(Table, erlang:phash2(Key), [ {P, unslice_field(V)} || {P, V} <- Op ]));
         false ->
             error(badarg)
     end.
 
+%% Results of delta ops come back from the NIF last op first, unless
+%% the write was refused.
+reverse({error, _} = Error) -> Error;
+reverse(Results) -> lists:reverse(Results).
+
+only({error, _} = Error) -> Error;
+only([Result]) -> Result.
+
 is_incr_op({P,V}) when is_integer(P), is_integer(V) -> true;
 is_incr_op(_) -> false.
 
@@ -117,6 +209,33 @@ is_unshift_op(_) -> false.
 is_swap_op({P,V}) when is_integer(P) -> true;
 is_swap_op(_) -> false.
 
+%% Stored binaries share their buffer with the writer's, so a large
+%% field sliced from a bigger binary would keep all of it alive in the
+%% table. Such fields are copied here, by the writer, as the NIF can't
+%% tell a slice from a whole binary.
+unslice(Object) ->
+    unslice(Object, tuple_size(Object)).
+
+unslice(Object, 0) ->
+    Object;
+unslice(Object, N) ->
+    Field = element(N, Object),
+    case is_slice(Field) of
+        true -> unslice(setelement(N, Object, binary:copy(Field)), N - 1);
+        false -> unslice(Object, N - 1)
+    end.
+
+unslice_field(Field) ->
+    case is_slice(Field) of
+        true -> binary:copy(Field);
+        false -> Field
+    end.
+
+is_slice(Field) when is_binary(Field), byte_size(Field) >= ?SLICE_THRESHOLD ->
+    binary:referenced_byte_size(Field) > byte_size(Field);
+is_slice(_) ->
+    false.
+
 do_increment(_Table, _Key, _Op) ->
     ?nif_stub.
 
@@ -157,6 +276,29 @@ drain(Table) ->
 do_drain(_Table) ->
     ?nif_stub.
 
+gc_pause(_Table) ->
+    ?nif_stub.
+
+gc_resume(_Table) ->
+    ?nif_stub.
+
+%% Heap allocations the NIF has made since it was loaded, across all
+%% tables, or undefined unless it was built with -DNEURAL_ALLOC_COUNT.
+alloc_count() ->
+    ?nif_stub.
+
+%% Collects the garbage of one shard (0..63), or of all of them, on the
+%% table's batch thread and returns a {Shard, Micros, BytesReclaimed}
+%% tuple for each one collected. Runs while GC is paused, too. Options:
+%%   {min_garbage, Bytes}   skip shards holding less garbage than this
+compact(Table, Shard, Opts) when is_atom(Table), is_list(Opts) ->
+    MinGarbage = proplists:get_value(min_garbage, Opts, 0),
+    '$neural_batch_wait' = do_compact(Table, Shard, MinGarbage),
+    wait_batch_response().
+
+do_compact(_Table, _Shard, _MinGarbage) ->
+    ?nif_stub.
+
 dump(Table) ->
     '$neural_batch_wait' = do_dump(Table),
     wait_batch_response().
@@ -167,6 +309,21 @@ do_dump(_Table) ->
 key_pos(_Table) ->
     ?nif_stub.
 
+checkpoint(_Table) ->
+    ?nif_stub.
+
+gc_stats(_Table) ->
+    ?nif_stub.
+
+telemetry(_Table, _Pid, _IntervalMs) ->
+    ?nif_stub.
+
+trace_dump(_Table) ->
+    ?nif_stub.
+
+hot_keys(_Table, _N) ->
+    ?nif_stub.
+
 wait_batch_response() ->
     receive
         {'$neural_batch_response', Response} -> Response
@@ -0,0 +1,76 @@
+-module(neural_alloc_bench).
+-export([test/0, run/1]).
+
+%% Counts the heap allocations the NIF makes per op once a table is
+%% warm. Needs a NIF built with -DNEURAL_ALLOC_COUNT; run/1 returns
+%% undefined otherwise. For each op it runs warmup ops first, so the
+%% scratch arenas and node pools of the schedulers have grown, then
+%% prints one row with:
+%%
+%%   op       the op measured
+%%   ops      ops run
+%%   allocs   allocations made while they ran
+%%   per_op   allocations per op, in thousandths
+%%
+%% GC is paused while measuring, and the counter covers the whole NIF,
+%% so keep other tables idle. Steady state lookups and delta ops on
+%% existing keys should show 0. run/1 also returns the rows.
+
+-define(DEFAULTS, [{table, neural_alloc_bench},
+                   {engine, env},
+                   {keys, 1000},
+                   {warmup, 10000},
+                   {ops, 100000}]).
+
+-define(FIELDS, [op, ops, allocs, per_op]).
+
+test() ->
+    run([]).
+
+run(Opts) ->
+    case neural:alloc_count() of
+        undefined ->
+            undefined;
+        _ ->
+            Conf = conf(Opts),
+            Table = proplists:get_value(table, Conf),
+            Keys = proplists:get_value(keys, Conf),
+            % Reuses the table of an earlier run, as tables can't be deleted.
+            _ = (catch neural:new(Table, [{engine, proplists:get_value(engine, Conf)}])),
+            [ neural:insert(Table, {Key, 0, [], a}) || Key <- lists:seq(1, Keys) ],
+            neural:gc_pause(Table),
+            io:format(string:join([ "~10s" || _ <- ?FIELDS ], " ") ++ "~n", [ atom_to_list(F) || F <- ?FIELDS ]),
+            Rows = [ measure(Op, Conf) || Op <- [lookup, increment, swap, unshift_shift, insert] ],
+            neural:gc_resume(Table),
+            neural:empty(Table),
+            Rows
+    end.
+
+measure(Op, Conf) ->
+    N = proplists:get_value(ops, Conf),
+    loop(Op, proplists:get_value(warmup, Conf), Conf),
+    Before = neural:alloc_count(),
+    loop(Op, N, Conf),
+    Allocs = neural:alloc_count() - Before,
+    Row = [{op, Op}, {ops, N}, {allocs, Allocs}, {per_op, Allocs * 1000 div N}],
+    io:format("~10s ~10b ~10b ~10b~n", [ atom_to_list(Op) | [ proplists:get_value(F, Row) || F <- tl(?FIELDS) ] ]),
+    Row.
+
+loop(_Op, 0, _Conf) ->
+    ok;
+loop(Op, N, Conf) ->
+    Table = proplists:get_value(table, Conf),
+    Key = N rem proplists:get_value(keys, Conf) + 1,
+    case Op of
+        lookup -> neural:lookup(Table, Key);
+        increment -> neural:increment(Table, Key, {2, 1});
+        swap -> neural:swap(Table, Key, {4, b});
+        unshift_shift ->
+            neural:unshift(Table, Key, {3, [x]}),
+            neural:shift(Table, Key, {3, 1});
+        insert -> neural:insert(Table, {Key, N, [], a})
+    end,
+    loop(Op, N - 1, Conf).
+
+conf(Opts) ->
+    Opts ++ [ Default || Default = {K, _} <- ?DEFAULTS, not lists:keymember(K, 1, Opts) ].
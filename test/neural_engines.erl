@@ -0,0 +1,89 @@
+-module(neural_engines).
+-export([test/0, conformance/1, bench/1]).
+-define(ENGINES, [env, serialized]).
+-define(BENCH_KEYS, 10000).
+
+%% Runs the conformance checks and the benchmark against every engine.
+test() ->
+    [ ok = conformance(Engine) || Engine <- ?ENGINES ],
+    ok = tiered_large(),
+    [ bench(Engine) || Engine <- ?ENGINES ],
+    ok.
+
+conformance(Engine) ->
+    Table = table_name(conformance, Engine),
+    ok = neural:new(Table, [{engine, Engine}]),
+
+    ok = neural:insert(Table, {a, 1, [], x}),
+    {a, 1, [], x} = neural:lookup(Table, a),
+    undefined = neural:lookup(Table, missing),
+    false = neural:insert_new(Table, {a, 2, [], y}),
+    true = neural:insert_new(Table, {b, 2, [], y}),
+    {ok, {b, 2, [], y}} = neural:insert(Table, {b, 3, [], y}),
+
+    4 = neural:increment(Table, a, 3),
+    [5, 14] = neural:increment(Table, a, [{2, 1}, {2, 9}]),
+    [2, 3] = neural:unshift(Table, a, [{3, [p, q]}, {3, [r]}]),
+    [q, r] = neural:shift(Table, a, {3, 2}),
+    x = neural:swap(Table, a, {4, z}),
+    {a, 14, [p], z} = neural:lookup(Table, a),
+    {'EXIT', {badarg, _}} = (catch neural:increment(Table, a, {4, 1})),
+    {a, 14, [p], z} = neural:lookup(Table, a),
+
+    {b, 3, [], y} = neural:delete(Table, b),
+    undefined = neural:delete(Table, b),
+    undefined = neural:lookup(Table, b),
+
+    [ neural:insert(Table, {N, N}) || N <- lists:seq(1, 1000) ],
+    1001 = length(neural:dump(Table)),
+    ok = neural:garbage(Table),
+    true = is_integer(neural:garbage_size(Table)),
+    {500, 500} = neural:lookup(Table, 500),
+    1001 = length(neural:drain(Table)),
+    [] = neural:dump(Table),
+
+    ok = neural:insert(Table, {c, 1}),
+    ok = neural:empty(Table),
+    undefined = neural:lookup(Table, c),
+    ok.
+
+%% A large tuple that is compressed and spilled while idle must come
+%% back whole when a write faults it in. Only the env engine tiers.
+tiered_large() ->
+    Table = neural_engines_tiered_large,
+    Dir = "/tmp/neural_engines." ++ os:getpid(),
+    ok = filelib:ensure_dir(Dir ++ "/"),
+    ok = neural:new(Table, [{engine, env}, {tier, Dir}, {tier_idle, 1},
+                            {compress, 64}, {compress_idle, 1}, {large_object, 256}]),
+    Value = [ {N, integer_to_list(N)} || N <- lists:seq(1, 2000) ],
+    ok = neural:insert(Table, {big, 0, Value}),
+    % Sweeps run every second; give one the chance to see it idle.
+    timer:sleep(3000),
+    1 = neural:increment(Table, big, 1),
+    {big, 1, Value} = neural:lookup(Table, big),
+    ok = neural:garbage(Table),
+    {big, 1, Value} = neural:lookup(Table, big),
+    ok = neural:empty(Table),
+    [ file:delete(File) || File <- filelib:wildcard(Dir ++ "/*") ],
+    _ = file:del_dir(Dir),
+    ok.
+
+bench(Engine) ->
+    Table = table_name(bench, Engine),
+    ok = neural:new(Table, [{engine, Engine}]),
+    Keys = lists:seq(1, ?BENCH_KEYS),
+    Results = [ {Op, time_op(Fun, Keys)} || {Op, Fun} <- [
+                {insert, fun(K) -> neural:insert(Table, {K, 0, [], <<"value">>}) end},
+                {lookup, fun(K) -> neural:lookup(Table, K) end},
+                {increment, fun(K) -> neural:increment(Table, K, 1) end},
+                {unshift, fun(K) -> neural:unshift(Table, K, {3, [K]}) end},
+                {delete, fun(K) -> neural:delete(Table, K) end}] ],
+    io:format("~p: ~s~n", [Engine, string:join([ io_lib:format("~p ~.2fus/op", [Op, Us]) || {Op, Us} <- Results ], ", ")]),
+    Results.
+
+time_op(Fun, Keys) ->
+    {Dur, _} = timer:tc(fun() -> lists:foreach(Fun, Keys) end),
+    Dur / length(Keys).
+
+table_name(Prefix, Engine) ->
+    list_to_atom(lists:concat([neural_engines_, Prefix, "_", Engine])).
@@ -0,0 +1,127 @@
+-module(neural_gc_bench).
+-export([test/0, run/1]).
+
+%% A write-heavy delta workload for judging garbage collection policy.
+%% Workers swap large values into stored tuples and unshift onto long
+%% lists, which leaves plenty of garbage behind, while a sampler prints
+%% one row per interval with:
+%%
+%%   t        ms since the start
+%%   ops      ops completed during the interval
+%%   p50..max op latency during the interval, in microseconds
+%%   gc_runs  bucket collections during the interval
+%%   gc_us    time buckets spent locked for collection during the interval
+%%   pause    mean time a bucket was locked per collection, in microseconds
+%%   freed    bytes reclaimed during the interval
+%%   garbage  garbage_size/1 at the end of the interval
+%%   rss/hwm  resident and peak resident set size of the node, in KiB
+%%
+%% run/1 also returns the rows, for further processing.
+
+-define(DEFAULTS, [{table, neural_gc_bench},
+                   {engine, env},
+                   {procs, 16},
+                   {duration, 30000},       % ms
+                   {interval, 1000},        % ms per row
+                   {keys, 1000},
+                   {value_size, 256},       % elements per swapped value
+                   {list_cap, 1024}]).      % unshifted lists are shifted back below this
+
+-define(FIELDS, [t, ops, p50, p99, p999, max, gc_runs, gc_us, pause, freed, garbage, rss, hwm]).
+
+test() ->
+    run([]).
+
+run(Opts) ->
+    Conf = conf(Opts),
+    Table = proplists:get_value(table, Conf),
+    % Reuses the table of an earlier run, as tables can't be deleted.
+    _ = (catch neural:new(Table, [{engine, proplists:get_value(engine, Conf)}])),
+    [ neural:insert(Table, {Key, value(Conf), []}) || Key <- lists:seq(1, proplists:get_value(keys, Conf)) ],
+
+    Workers = [ spawn_link(fun() -> worker(Conf, neural_hist:new()) end) || _ <- lists:seq(1, proplists:get_value(procs, Conf)) ],
+    io:format(string:join([ "~10s" || _ <- ?FIELDS ], " ") ++ "~n", [ atom_to_list(F) || F <- ?FIELDS ]),
+    Start = erlang:monotonic_time(millisecond),
+    Rows = sample(Workers, Start, Start + proplists:get_value(duration, Conf), gc_totals(Table), Conf, []),
+    [ begin unlink(Pid), exit(Pid, kill) end || Pid <- Workers ],
+    neural:empty(Table),
+    Rows.
+
+sample(Workers, Start, Stop, {LastRuns, LastUs, LastFreed}, Conf, Rows) ->
+    Table = proplists:get_value(table, Conf),
+    receive after proplists:get_value(interval, Conf) -> ok end,
+    Hist = collect(Workers),
+    Totals = {Runs, Us, Freed} = gc_totals(Table),
+    Now = erlang:monotonic_time(millisecond),
+    {Rss, Hwm} = memory(),
+    Row = [{t, Now - Start}, {ops, neural_hist:count(Hist)} | tl(neural_hist:summary(Hist))]
+          ++ [{gc_runs, Runs - LastRuns}, {gc_us, Us - LastUs}, {pause, per_run(Us - LastUs, Runs - LastRuns)},
+              {freed, Freed - LastFreed}, {garbage, neural:garbage_size(Table)}, {rss, Rss}, {hwm, Hwm}],
+    io:format(string:join([ "~10b" || _ <- ?FIELDS ], " ") ++ "~n", [ proplists:get_value(F, Row) || F <- ?FIELDS ]),
+    case Now >= Stop of
+        true -> lists:reverse([Row|Rows]);
+        false -> sample(Workers, Start, Stop, Totals, Conf, [Row|Rows])
+    end.
+
+%% Collects and resets the latency histograms of all workers.
+collect(Workers) ->
+    Ref = make_ref(),
+    [ Pid ! {flush, self(), Ref} || Pid <- Workers ],
+    lists:foldl(fun(_, Acc) ->
+                    receive {Ref, H} -> neural_hist:merge(Acc, H) end
+                end, neural_hist:new(), Workers).
+
+worker(Conf, Hist) ->
+    Table = proplists:get_value(table, Conf),
+    Key = rand:uniform(proplists:get_value(keys, Conf)),
+    Cap = proplists:get_value(list_cap, Conf),
+    Begin = erlang:monotonic_time(),
+    case rand:uniform(2) of
+        1 -> neural:swap(Table, Key, {2, value(Conf)});
+        2 ->
+            case neural:unshift(Table, Key, {3, value(Conf)}) of
+                Len when Len > Cap -> neural:shift(Table, Key, {3, Len div 2});
+                _ -> ok
+            end
+    end,
+    Latency = erlang:convert_time_unit(erlang:monotonic_time() - Begin, native, microsecond),
+    receive
+        {flush, From, Ref} ->
+            From ! {Ref, neural_hist:record(Latency, Hist)},
+            worker(Conf, neural_hist:new())
+    after 0 ->
+        worker(Conf, neural_hist:record(Latency, Hist))
+    end.
+
+value(Conf) ->
+    lists:seq(1, proplists:get_value(value_size, Conf)).
+
+%% {Runs, Micros, BytesReclaimed} summed over all buckets.
+gc_totals(Table) ->
+    lists:foldl(fun({Runs, Us, Freed}, {R, U, F}) -> {R + Runs, U + Us, F + Freed} end,
+                {0, 0, 0}, neural:gc_stats(Table)).
+
+per_run(_Us, 0) -> 0;
+per_run(Us, Runs) -> Us div Runs.
+
+%% VmRSS and VmHWM of the node, in KiB, or zero where /proc is missing.
+memory() ->
+    case file:read_file("/proc/self/status") of
+        {ok, Status} ->
+            {status_kb(<<"VmRSS:">>, Status), status_kb(<<"VmHWM:">>, Status)};
+        _ ->
+            {0, 0}
+    end.
+
+status_kb(Field, Status) ->
+    case binary:match(Status, Field) of
+        {Pos, Len} ->
+            Rest = binary:part(Status, Pos + Len, byte_size(Status) - Pos - Len),
+            [Value|_] = binary:split(Rest, <<"kB">>),
+            binary_to_integer(string:trim(Value));
+        nomatch ->
+            0
+    end.
+
+conf(Opts) ->
+    Opts ++ [ Default || Default = {K, _} <- ?DEFAULTS, not lists:keymember(K, 1, Opts) ].
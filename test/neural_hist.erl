@@ -0,0 +1,80 @@
+-module(neural_hist).
+-export([new/0, record/2, merge/2, count/1, max/1, percentile/2, summary/1]).
+
+%% A log-linear latency histogram in the style of HdrHistogram. Values
+%% below 2^?SUB_BITS are counted exactly; larger ones fall into one of
+%% 2^(?SUB_BITS - 1) buckets per power of two, which keeps every
+%% reported value within 1/64 (about 1.6%) of the true one. Values are
+%% whatever unit the caller records, typically microseconds.
+-define(SUB_BITS, 7).
+-define(HALF, (1 bsl (?SUB_BITS - 1))).
+
+-record(hist, {
+        counts = #{} :: #{non_neg_integer() => pos_integer()},
+        total  = 0 :: non_neg_integer(),
+        max    = 0 :: non_neg_integer()
+    }).
+
+new() ->
+    #hist{}.
+
+record(Value, Hist = #hist{counts = Counts, total = Total, max = Max}) when is_integer(Value), Value >= 0 ->
+    Index = index(Value),
+    Hist#hist{counts = maps:update_with(Index, fun(N) -> N + 1 end, 1, Counts),
+              total = Total + 1,
+              max = erlang:max(Max, Value)}.
+
+merge(#hist{counts = A, total = TA, max = MA}, #hist{counts = B, total = TB, max = MB}) ->
+    Counts = maps:fold(fun(Index, N, Acc) -> maps:update_with(Index, fun(M) -> M + N end, N, Acc) end, A, B),
+    #hist{counts = Counts, total = TA + TB, max = erlang:max(MA, MB)}.
+
+count(#hist{total = Total}) ->
+    Total.
+
+max(#hist{max = Max}) ->
+    Max.
+
+%% The highest value equivalent to the one at percentile P (0..100).
+percentile(#hist{total = 0}, _P) ->
+    0;
+percentile(#hist{counts = Counts, total = Total, max = Max}, P) ->
+    Rank = erlang:max(1, ceil_int(Total * P / 100)),
+    erlang:min(Max, walk(lists:sort(maps:to_list(Counts)), Rank)).
+
+summary(Hist) ->
+    [{count, count(Hist)},
+     {p50, percentile(Hist, 50)},
+     {p99, percentile(Hist, 99)},
+     {p999, percentile(Hist, 99.9)},
+     {max, max(Hist)}].
+
+walk([{Index, N}|_], Rank) when Rank =< N ->
+    highest(Index);
+walk([{_, N}|Rest], Rank) ->
+    walk(Rest, Rank - N).
+
+index(Value) when Value < (1 bsl ?SUB_BITS) ->
+    Value;
+index(Value) ->
+    Shift = msb(Value) - (?SUB_BITS - 1),
+    Shift * ?HALF + (Value bsr Shift).
+
+highest(Index) when Index < (1 bsl ?SUB_BITS) ->
+    Index;
+highest(Index) ->
+    Shift = Index div ?HALF - 1,
+    Mantissa = Index - Shift * ?HALF,
+    ((Mantissa + 1) bsl Shift) - 1.
+
+msb(Value) ->
+    msb(Value bsr 1, 0).
+
+msb(0, Bit) -> Bit;
+msb(Value, Bit) -> msb(Value bsr 1, Bit + 1).
+
+ceil_int(X) ->
+    T = trunc(X),
+    case X > T of
+        true -> T + 1;
+        false -> T
+    end.
@@ -0,0 +1,97 @@
+-module(neural_json).
+-export([encode/1, decode/1]).
+
+%% Just enough JSON for benchmark results: maps with atom or binary
+%% keys, lists, numbers, binaries, booleans and null. Objects decode
+%% to maps with binary keys.
+
+encode(Map) when is_map(Map) ->
+    Fields = [ [encode_key(K), $:, encode(V)] || {K, V} <- lists:sort(maps:to_list(Map)) ],
+    [${, join(Fields, $,), $}];
+encode(List) when is_list(List) ->
+    [$[, join([ encode(V) || V <- List ], $,), $]];
+encode(true) -> <<"true">>;
+encode(false) -> <<"false">>;
+encode(null) -> <<"null">>;
+encode(Atom) when is_atom(Atom) -> encode(atom_to_binary(Atom, utf8));
+encode(Int) when is_integer(Int) -> integer_to_binary(Int);
+encode(Float) when is_float(Float) -> float_to_binary(Float, [{decimals, 6}, compact]);
+encode(Bin) when is_binary(Bin) -> [$", escape(Bin), $"].
+
+encode_key(K) when is_atom(K) -> encode(atom_to_binary(K, utf8));
+encode_key(K) when is_binary(K) -> encode(K).
+
+join([], _Sep) -> [];
+join([H|T], Sep) -> [H | [ [Sep, X] || X <- T ]].
+
+escape(Bin) ->
+    << <<(escape_char(C))/binary>> || <<C>> <= Bin >>.
+
+escape_char($") -> <<"\\\"">>;
+escape_char($\\) -> <<"\\\\">>;
+escape_char($\n) -> <<"\\n">>;
+escape_char(C) when C < 16#20 -> list_to_binary(io_lib:format("\\u~4.16.0b", [C]));
+escape_char(C) -> <<C>>.
+
+decode(Data) ->
+    {Value, Rest} = value(skip(iolist_to_binary(Data))),
+    <<>> = skip(Rest),
+    Value.
+
+value(<<${, Rest/binary>>) -> object(skip(Rest), #{});
+value(<<$[, Rest/binary>>) -> array(skip(Rest), []);
+value(<<$", Rest/binary>>) -> string(Rest, <<>>);
+value(<<"true", Rest/binary>>) -> {true, Rest};
+value(<<"false", Rest/binary>>) -> {false, Rest};
+value(<<"null", Rest/binary>>) -> {null, Rest};
+value(Bin) -> number(Bin).
+
+object(<<$}, Rest/binary>>, Acc) ->
+    {Acc, Rest};
+object(<<$", Bin/binary>>, Acc) ->
+    {Key, Rest0} = string(Bin, <<>>),
+    <<$:, Rest1/binary>> = skip(Rest0),
+    {Value, Rest2} = value(skip(Rest1)),
+    case skip(Rest2) of
+        <<$,, Rest3/binary>> -> object(skip(Rest3), Acc#{Key => Value});
+        <<$}, Rest3/binary>> -> {Acc#{Key => Value}, Rest3}
+    end.
+
+array(<<$], Rest/binary>>, []) ->
+    {[], Rest};
+array(Bin, Acc) ->
+    {Value, Rest0} = value(Bin),
+    case skip(Rest0) of
+        <<$,, Rest1/binary>> -> array(skip(Rest1), [Value|Acc]);
+        <<$], Rest1/binary>> -> {lists:reverse([Value|Acc]), Rest1}
+    end.
+
+string(<<$", Rest/binary>>, Acc) -> {Acc, Rest};
+string(<<$\\, $n, Rest/binary>>, Acc) -> string(Rest, <<Acc/binary, $\n>>);
+string(<<$\\, $t, Rest/binary>>, Acc) -> string(Rest, <<Acc/binary, $\t>>);
+string(<<$\\, $u, Hex:4/binary, Rest/binary>>, Acc) ->
+    string(Rest, <<Acc/binary, (unicode:characters_to_binary([binary_to_integer(Hex, 16)]))/binary>>);
+string(<<$\\, C, Rest/binary>>, Acc) -> string(Rest, <<Acc/binary, C>>);
+string(<<C, Rest/binary>>, Acc) -> string(Rest, <<Acc/binary, C>>).
+
+number(Bin) ->
+    {Num, Rest} = lists:splitwith(fun(C) -> lists:member(C, "+-0123456789.eE") end, binary_to_list(Bin)),
+    Value = case catch list_to_integer(Num) of
+                Int when is_integer(Int) -> Int;
+                _ -> list_to_float(float_form(Num))
+            end,
+    {Value, list_to_binary(Rest)}.
+
+% list_to_float/1 wants a fraction before any exponent.
+float_form(Num) ->
+    case {lists:member($., Num), string:split(Num, "e", leading)} of
+        {false, [Mantissa, Exp]} -> Mantissa ++ ".0e" ++ Exp;
+        {false, _} -> case string:split(Num, "E", leading) of
+                          [Mantissa, Exp] -> Mantissa ++ ".0e" ++ Exp;
+                          _ -> Num ++ ".0"
+                      end;
+        {true, _} -> Num
+    end.
+
+skip(<<C, Rest/binary>>) when C =:= $\s; C =:= $\t; C =:= $\n; C =:= $\r -> skip(Rest);
+skip(Bin) -> Bin.
@@ -0,0 +1,160 @@
+-module(neural_linearize).
+-export([test/0, run/1, check/1]).
+
+%% A randomized stress test that checks single-key ops for
+%% linearizability. Each round, workers hammer a handful of fresh keys
+%% with inserts, lookups, deletes and increments while other processes
+%% force garbage collection and dump the table without pause. Every op
+%% is recorded with the points at which it was invoked and returned,
+%% and the history of each key is then searched, in the manner of
+%% Wing & Gong with Lowe's memoization, for an order of the ops that
+%% respects real time and agrees with a sequential model of the key.
+%% Linearizability is compositional, so checking keys one at a time is
+%% enough.
+%%
+%% run/1 returns ok, or {error, Key, History} with the first history
+%% that has no such order, or {error, no_collections} if no bucket was
+%% collected during the run.
+
+-define(DEFAULTS, [{table, neural_linearize},
+                   {engine, env},
+                   {rounds, 50},
+                   {procs, 8},
+                   {keys, 3},
+                   {ops, 30}]).             % per worker per round
+
+-record(op, {id, call, result, invoked, returned}).
+
+test() ->
+    run([]).
+
+run(Opts) ->
+    Conf = conf(Opts),
+    Table = proplists:get_value(table, Conf),
+    % Reuses the table of an earlier run, as tables can't be deleted.
+    _ = (catch neural:new(Table, [{engine, proplists:get_value(engine, Conf)}])),
+    % garbage/1 only wakes the collector, which does nothing while the
+    % table holds little garbage; compact/3 collects every bucket.
+    Noise = [ spawn_link(fun() -> loop(fun() -> neural:compact(Table, all, []) end) end),
+              spawn_link(fun() -> loop(fun() -> neural:dump(Table) end) end) ],
+    Runs = gc_runs(Table),
+    Result = rounds(1, Conf),
+    [ begin unlink(Pid), exit(Pid, kill) end || Pid <- Noise ],
+    Collected = gc_runs(Table) > Runs,
+    neural:empty(Table),
+    case Result of
+        ok when not Collected -> {error, no_collections};
+        _ -> Result
+    end.
+
+rounds(Round, Conf) ->
+    case Round > proplists:get_value(rounds, Conf) of
+        true -> ok;
+        false ->
+            case round(Round, Conf) of
+                ok -> rounds(Round + 1, Conf);
+                Error -> Error
+            end
+    end.
+
+round(Round, Conf) ->
+    Keys = [ {Round, N} || N <- lists:seq(1, proplists:get_value(keys, Conf)) ],
+    Self = self(),
+    Pids = [ spawn_link(fun() -> Self ! {history, self(), worker(Keys, proplists:get_value(ops, Conf), Conf, [])} end)
+             || _ <- lists:seq(1, proplists:get_value(procs, Conf)) ],
+    History = lists:append([ receive {history, Pid, H} -> H end || Pid <- Pids ]),
+    check_keys(Keys, History).
+
+check_keys([], _History) ->
+    ok;
+check_keys([Key|Keys], History) ->
+    Ops = [ Op || {K, Op} <- History, K =:= Key ],
+    case check(Ops) of
+        true -> check_keys(Keys, History);
+        false -> {error, Key, lists:keysort(#op.invoked, Ops)}
+    end.
+
+worker(_Keys, 0, _Conf, History) ->
+    History;
+worker(Keys, N, Conf, History) ->
+    Table = proplists:get_value(table, Conf),
+    Key = lists:nth(rand:uniform(length(Keys)), Keys),
+    Call = case rand:uniform(6) of
+               1 -> {insert, rand:uniform(100)};
+               2 -> {insert_new, rand:uniform(100)};
+               3 -> delete;
+               4 -> increment;
+               _ -> lookup
+           end,
+    Invoked = erlang:unique_integer([monotonic]),
+    Result = try apply_op(Table, Key, Call) catch error:Reason -> {error, Reason} end,
+    Returned = erlang:unique_integer([monotonic]),
+    Op = #op{id = Invoked, call = Call, result = Result, invoked = Invoked, returned = Returned},
+    worker(Keys, N - 1, Conf, [{Key, Op}|History]).
+
+apply_op(Table, Key, {insert, V}) -> neural:insert(Table, {Key, V});
+apply_op(Table, Key, {insert_new, V}) -> neural:insert_new(Table, {Key, V});
+apply_op(Table, Key, delete) -> neural:delete(Table, Key);
+apply_op(Table, Key, increment) -> neural:increment(Table, Key, 1);
+apply_op(Table, Key, lookup) -> neural:lookup(Table, Key).
+
+%% The sequential model of one key: its stored value, or undefined.
+step(undefined, {insert, V}) -> {ok, V};
+step(Old, {insert, V}) -> {{ok, tuple(Old)}, V};
+step(undefined, {insert_new, V}) -> {true, V};
+step(Old, {insert_new, _}) -> {false, Old};
+step(Old, delete) -> {tuple(Old), undefined};
+step(undefined, increment) -> {{error, badarg}, undefined};
+step(Old, increment) -> {Old + 1, Old + 1};
+step(Old, lookup) -> {tuple(Old), Old}.
+
+% Stored tuples are {Key, Value}; the key is the same for every op of
+% a history, so only the value is modelled.
+tuple(undefined) -> undefined;
+tuple(V) -> {key, V}.
+
+%% True if the ops of one key, all starting from an absent key, can be
+%% linearized.
+check(Ops) ->
+    Seen = ets:new(seen, [set, private]),
+    Result = search(lists:keysort(#op.invoked, Ops), undefined, Seen),
+    ets:delete(Seen),
+    Result.
+
+search([], _State, _Seen) ->
+    true;
+search(Ops, State, Seen) ->
+    Ids = [ Id || #op{id = Id} <- Ops ],
+    case ets:insert_new(Seen, {{Ids, State}}) of
+        false ->
+            % Already explored from here and failed.
+            false;
+        true ->
+            % Only ops invoked before every remaining op has returned can go first.
+            Horizon = lists:min([ R || #op{returned = R} <- Ops ]),
+            try_first([ Op || Op = #op{invoked = I} <- Ops, I < Horizon ], Ops, State, Seen)
+    end.
+
+try_first([], _Ops, _State, _Seen) ->
+    false;
+try_first([Op = #op{call = Call, result = Result}|Candidates], Ops, State, Seen) ->
+    {Expected, Next} = step(State, Call),
+    case matches(Expected, Result) andalso search(lists:keydelete(Op#op.id, #op.id, Ops), Next, Seen) of
+        true -> true;
+        false -> try_first(Candidates, Ops, State, Seen)
+    end.
+
+matches({ok, {key, V}}, {ok, {_, V}}) -> true;
+matches({key, V}, {_, V}) -> true;
+matches(Same, Same) -> true;
+matches(_, _) -> false.
+
+loop(Fun) ->
+    Fun(),
+    loop(Fun).
+
+gc_runs(Table) ->
+    lists:sum([ Runs || {Runs, _Us, _Freed} <- neural:gc_stats(Table) ]).
+
+conf(Opts) ->
+    Opts ++ [ Default || Default = {K, _} <- ?DEFAULTS, not lists:keymember(K, 1, Opts) ].
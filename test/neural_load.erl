@@ -0,0 +1,102 @@
+-module(neural_load).
+-export([test/0, run/1, step/2]).
+
+%% An open-loop load generator. Unlike neural_concurrency, which waits
+%% for each op before timing the next, workers here issue ops on a
+%% fixed schedule and measure each one from the moment it was due.
+%% When the table falls behind, the time ops spend queued behind
+%% their predecessors shows up in the latencies instead of silently
+%% lowering the offered rate.
+%%
+%% run/1 sweeps a list of offered rates and prints p50/p99/p99.9/max
+%% latency in microseconds for each, so the knee where the achieved
+%% rate stops following the offered one stands out.
+
+-define(DEFAULTS, [{table, neural_load},
+                   {engine, env},
+                   {rates, [1000, 5000, 10000, 25000, 50000, 100000, 200000]},
+                   {procs, 64},
+                   {duration, 5000},        % ms per step
+                   {keys, 10000},
+                   {mix, [{lookup, 80}, {increment, 15}, {insert, 5}]}]).
+
+test() ->
+    run([]).
+
+run(Opts) ->
+    Conf = conf(Opts),
+    Table = proplists:get_value(table, Conf),
+    % Reuses the table of an earlier run, as tables can't be deleted.
+    _ = (catch neural:new(Table, [{engine, proplists:get_value(engine, Conf)}])),
+    [ neural:insert(Table, {Key, 0, 0}) || Key <- lists:seq(1, proplists:get_value(keys, Conf)) ],
+    io:format("~10s ~10s ~10s ~10s ~10s ~10s~n", ["offered", "achieved", "p50", "p99", "p99.9", "max"]),
+    Results = [ begin
+                    Result = step(Rate, Conf),
+                    print(Result),
+                    Result
+                end || Rate <- proplists:get_value(rates, Conf) ],
+    neural:empty(Table),
+    Results.
+
+%% Offers Rate ops per second for the configured duration and returns
+%% the achieved rate with the latency summary.
+step(Rate, Conf) ->
+    Procs = proplists:get_value(procs, Conf),
+    Duration = erlang:convert_time_unit(proplists:get_value(duration, Conf), millisecond, native),
+    % Each worker offers Rate / Procs, staggered so they don't fire together.
+    Interval = erlang:convert_time_unit(1, second, native) * Procs div Rate,
+    Start = erlang:monotonic_time() + erlang:convert_time_unit(100, millisecond, native),
+    Self = self(),
+    Pids = [ spawn_link(fun() ->
+                 Self ! {hist, self(), worker(Start + N * Interval div Procs, Start + Duration, Interval, Conf, neural_hist:new())}
+             end) || N <- lists:seq(0, Procs - 1) ],
+    Hist = lists:foldl(fun(Pid, Acc) ->
+                           receive {hist, Pid, H} -> neural_hist:merge(Acc, H) end
+                       end, neural_hist:new(), Pids),
+    Elapsed = erlang:monotonic_time() - Start,
+    Achieved = neural_hist:count(Hist) * erlang:convert_time_unit(1, second, native) div erlang:max(1, Elapsed),
+    [{offered, Rate}, {achieved, Achieved} | neural_hist:summary(Hist)].
+
+worker(Due, Stop, _Interval, _Conf, Hist) when Due >= Stop ->
+    Hist;
+worker(Due, Stop, Interval, Conf, Hist) ->
+    wait_until(Due),
+    op(Conf),
+    Latency = erlang:convert_time_unit(erlang:monotonic_time() - Due, native, microsecond),
+    worker(Due + Interval, Stop, Interval, Conf, neural_hist:record(Latency, Hist)).
+
+wait_until(Due) ->
+    Ahead = erlang:convert_time_unit(Due - erlang:monotonic_time(), native, millisecond),
+    if
+        Ahead > 1 ->
+            receive after Ahead - 1 -> ok end,
+            wait_until(Due);
+        true ->
+            spin(Due)
+    end.
+
+spin(Due) ->
+    case erlang:monotonic_time() >= Due of
+        true -> ok;
+        false -> erlang:yield(), spin(Due)
+    end.
+
+op(Conf) ->
+    Table = proplists:get_value(table, Conf),
+    Key = rand:uniform(proplists:get_value(keys, Conf)),
+    case pick(rand:uniform(100), proplists:get_value(mix, Conf)) of
+        lookup -> neural:lookup(Table, Key);
+        increment -> neural:increment(Table, Key, 1);
+        insert -> neural:insert(Table, {Key, 0, 0})
+    end.
+
+pick(Roll, [{Op, Weight}|_]) when Roll =< Weight -> Op;
+pick(Roll, [{_, Weight}|Rest]) -> pick(Roll - Weight, Rest);
+pick(_Roll, []) -> lookup.
+
+print(Result) ->
+    io:format("~10b ~10b ~10b ~10b ~10b ~10b~n",
+              [ proplists:get_value(K, Result) || K <- [offered, achieved, p50, p99, p999, max] ]).
+
+conf(Opts) ->
+    Opts ++ [ Default || Default = {K, _} <- ?DEFAULTS, not lists:keymember(K, 1, Opts) ].
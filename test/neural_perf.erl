@@ -0,0 +1,99 @@
+-module(neural_perf).
+-export([check/0, baseline/0, run/1, compare/3]).
+
+%% Runs a fixed set of benchmark scenarios and compares the results
+%% with the baseline committed in test/perf_baseline.json. A scenario
+%% regresses when its throughput drops, or its p99 latency rises, by
+%% more than its tolerance: the "tolerance" recorded for it in the
+%% baseline, or ?TOLERANCE if it has none. Tolerances can be tuned by
+%% editing the baseline.
+%%
+%% `make perf` runs check/0, which writes the results to
+%% perf_results.json and halts with status 1 on any regression.
+%% `make perf-baseline` runs baseline/0, which overwrites the baseline
+%% with a fresh run, keeping any tolerances already in it.
+
+-define(BASELINE, "test/perf_baseline.json").
+-define(RESULTS, "perf_results.json").
+-define(TOLERANCE, 0.1).
+-define(LOAD_RATES, [10000, 50000, 100000]).
+-define(LOAD_DURATION, 3000).
+
+check() ->
+    Results = run([]),
+    ok = file:write_file(?RESULTS, neural_json:encode(Results)),
+    Status = case file:read_file(?BASELINE) of
+                 {ok, Data} ->
+                     case compare(Results, neural_json:decode(Data), ?TOLERANCE) of
+                         [] -> 0;
+                         _ -> 1
+                     end;
+                 {error, Reason} ->
+                     io:format("No baseline at ~s (~p); run make perf-baseline~n", [?BASELINE, Reason]),
+                     0
+             end,
+    erlang:halt(Status).
+
+baseline() ->
+    Results = run([]),
+    Tolerances = case file:read_file(?BASELINE) of
+                     {ok, Data} -> maps:map(fun(_, Old) -> maps:with([<<"tolerance">>], Old) end, neural_json:decode(Data));
+                     _ -> #{}
+                 end,
+    Merged = maps:map(fun(Name, Metrics) -> maps:merge(Metrics, maps:get(Name, Tolerances, #{})) end, Results),
+    ok = file:write_file(?BASELINE, [neural_json:encode(Merged), $\n]),
+    erlang:halt(0).
+
+%% Returns #{ScenarioName => #{<<"throughput">> => OpsPerSec, <<"p99">> => Micros}}.
+run(_Opts) ->
+    Conf = load_conf(),
+    Table = proplists:get_value(table, Conf),
+    _ = (catch neural:new(Table, [])),
+    [ neural:insert(Table, {Key, 0, 0}) || Key <- lists:seq(1, proplists:get_value(keys, Conf)) ],
+    Load = [ begin
+                 Result = neural_load:step(Rate, Conf),
+                 {scenario("load_~b", [Rate]), #{<<"throughput">> => proplists:get_value(achieved, Result),
+                                                 <<"p99">> => proplists:get_value(p99, Result)}}
+             end || Rate <- ?LOAD_RATES ],
+    Engines = [ {scenario("~s_~s", [Engine, Op]), #{<<"throughput">> => round(1000000 / erlang:max(Us, 0.001))}}
+                || Engine <- [env, serialized], {Op, Us} <- quietly(fun() -> neural_engines:bench(Engine) end) ],
+    maps:from_list(Load ++ Engines).
+
+%% Prints each scenario's result next to its baseline and returns the
+%% names of those that regressed.
+compare(Results, Baseline, DefaultTolerance) ->
+    lists:append([ compare_scenario(Name, Metrics, maps:get(Name, Baseline, undefined), DefaultTolerance)
+                   || {Name, Metrics} <- lists:sort(maps:to_list(Results)) ]).
+
+compare_scenario(Name, _Metrics, undefined, _DefaultTolerance) ->
+    io:format("~-28s new scenario, no baseline~n", [Name]),
+    [];
+compare_scenario(Name, Metrics, Base, DefaultTolerance) ->
+    Tolerance = maps:get(<<"tolerance">>, Base, DefaultTolerance),
+    Checks = [ {<<"throughput">>, fun(New, Old) -> New < Old * (1 - Tolerance) end},
+               {<<"p99">>, fun(New, Old) -> New > Old * (1 + Tolerance) end} ],
+    Regressed = [ Metric || {Metric, Worse} <- Checks,
+                            maps:is_key(Metric, Metrics), maps:is_key(Metric, Base),
+                            Worse(maps:get(Metric, Metrics), maps:get(Metric, Base)) ],
+    io:format("~-28s ~s~s~n", [Name,
+                                [ io_lib:format("~s ~p (baseline ~p)  ", [M, maps:get(M, Metrics), maps:get(M, Base, none)])
+                                  || M <- [<<"throughput">>, <<"p99">>], maps:is_key(M, Metrics) ],
+                                case Regressed of [] -> ""; _ -> "REGRESSED" end]),
+    case Regressed of
+        [] -> [];
+        _ -> [Name]
+    end.
+
+load_conf() ->
+    [{table, neural_perf_load}, {engine, env}, {procs, 64}, {duration, ?LOAD_DURATION}, {keys, 10000},
+     {mix, [{lookup, 80}, {increment, 15}, {insert, 5}]}].
+
+scenario(Format, Args) ->
+    iolist_to_binary(io_lib:format(Format, Args)).
+
+% neural_engines:bench/1 prints its own summary; keep the report tidy.
+quietly(Fun) ->
+    Leader = group_leader(),
+    {ok, Null} = file:open("/dev/null", [write]),
+    group_leader(Null, self()),
+    try Fun() after group_leader(Leader, self()), file:close(Null) end.
@@ -0,0 +1,76 @@
+-module(neural_recovery).
+-export([test/0, run/1]).
+
+%% Checks that a persistent table comes back after its node is killed
+%% with writes made since the last checkpoint. A child node inserts
+%% keys, checkpoints, then increments, inserts and deletes some more
+%% and kills itself with SIGKILL, so nothing gets to flush or mark the
+%% store clean. This node then reopens the store and expects every
+%% write, before and after the checkpoint, to be there.
+%%
+%% run/1 returns ok, or {error, Reason} for the first thing that
+%% doesn't match.
+
+-define(DEFAULTS, [{keys, 1000},
+                   {dir, "/tmp"}]).
+
+test() ->
+    run([]).
+
+run(Opts) ->
+    Conf = conf(Opts),
+    Keys = proplists:get_value(keys, Conf),
+    Path = filename:join(proplists:get_value(dir, Conf),
+                         "neural_recovery." ++ os:getpid() ++ ".store"),
+    _ = file:delete(Path),
+    Result = case crash(Path, Keys) of
+        ok -> verify(Path, Keys);
+        Error -> Error
+    end,
+    _ = file:delete(Path),
+    Result.
+
+%% Runs the writes in a child node that never checkpoints them.
+crash(Path, Keys) ->
+    Eval = io_lib:format(
+             "ok = neural:new(recovery, [{persist, ~p}]),"
+             "[ ok = neural:insert(recovery, {K, K, before}) || K <- lists:seq(1, ~b) ],"
+             "ok = neural:checkpoint(recovery),"
+             "[ neural:increment(recovery, K, 1) || K <- lists:seq(1, ~b) ],"
+             "[ ok = neural:insert(recovery, {K, K, later}) || K <- lists:seq(~b, ~b) ],"
+             "{1, 2, before} = neural:delete(recovery, 1),"
+             "io:format(\"written~~n\"),"
+             "os:cmd(\"kill -9 \" ++ os:getpid()).",
+             [Path, Keys, Keys, Keys + 1, 2 * Keys]),
+    Cmd = io_lib:format("~s -noshell -pa ~s -eval '~s'",
+                        [filename:join([code:root_dir(), "bin", "erl"]),
+                         filename:dirname(code:which(neural)), Eval]),
+    case string:find(os:cmd(lists:flatten(Cmd)), "written") of
+        nomatch -> {error, child_failed};
+        _ -> ok
+    end.
+
+verify(Path, Keys) ->
+    Table = list_to_atom("neural_recovery_" ++ integer_to_list(erlang:unique_integer([positive]))),
+    case catch neural:new(Table, [{persist, Path}]) of
+        ok ->
+            Expected = [{1, undefined}]
+                       ++ [ {K, {K, K + 1, before}} || K <- lists:seq(2, Keys) ]
+                       ++ [ {K, {K, K, later}} || K <- lists:seq(Keys + 1, 2 * Keys) ],
+            Result = check(Table, Expected),
+            neural:empty(Table),
+            Result;
+        Error ->
+            {error, {reopen, Error}}
+    end.
+
+check(_Table, []) ->
+    ok;
+check(Table, [{Key, Value}|Rest]) ->
+    case neural:lookup(Table, Key) of
+        Value -> check(Table, Rest);
+        Other -> {error, {Key, Value, Other}}
+    end.
+
+conf(Opts) ->
+    Opts ++ [ Default || Default = {K, _} <- ?DEFAULTS, not lists:keymember(K, 1, Opts) ].